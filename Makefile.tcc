@@ -15,14 +15,13 @@ RM=del
 # -G      Optimize for Speed
 # -O      Enable Jump Optimization
 # -Z      Enable Register Optimization
-# -f-     Don't link floating point lib
 # -r      Use Register Variables
 # -mt     Tiny memory model
 # -w      Display all warnings
 # -w-pia  Supress 'Possibly incorrect assignment' warnings
 # -n<dir> Output to <dir>
 #
-CFLAGS=-A -G -O -Z -f- -r -mt -w -w-pia -nbin
+CFLAGS=-A -G -O -Z -r -mt -w -w-pia -nbin
 
 TARGETS=\
 	src\8queens.exe  \
@@ -6,18 +6,77 @@
  * See the LICENSE file for details.
  *
  * Compiling: gcc -ansi -pedantic -Wall -W -O2 -o atoi atoi.c
+ * Defines:
+ *     USE_C:     Don't use the SWAR / SIMD digit parsing kernels.
+ *     USE_POSIX: Memory-map files, parse them with several threads, and use
+ *                clock_gettime() for the benchmark timer. Link with
+ *                -lpthread.
  *
  * Running:
  *     tim@cid ~ $ ./atoi abcdef
+ *     [1PS] The number was: 0 (hex: 0x0), 0 bytes used (no digits)
  *     [RTL] The number was: 11259375 (hex: 0xabcdef)
  *     [LTR] The number was: 11259375 (hex: 0xabcdef)
  *     tim@cid ~ $ ./atoi 987654321
+ *     [1PS] The number was: 987654321 (hex: 0x3ade68b1), 9 bytes used
  *     [RTL] The number was: 987654321 (hex: 0x3ade68b1)
  *     [LTR] The number was: 987654321 (hex: 0x3ade68b1)
+ *     tim@cid ~ $ ./atoi -b
+ *     Parser      Time (s)   ns/number
+ *     ...
  */
+#ifdef USE_POSIX
+#define _XOPEN_SOURCE 600
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef USE_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Number of numbers to parse for the benchmark */
+#define BENCH_COUNT 1000000
+
+/* Maximum number of threads for parse_fields_parallel() */
+#define MAX_THREADS 64
+
+/* Bytes of a file to parse at once with -f, bounding the output array */
+#if UINT_MAX <= 0xffffU
+#define FILE_BATCH 0x2000UL
+#else
+#define FILE_BATCH 0x400000UL
+#endif
+
+/* Delimiters between the fields for parse_fields() */
+#define IS_DELIM(C) ((C) == ',' || (C) == ' ' || (C) == '\n' || \
+                     (C) == '\r' || (C) == '\t')
+
+/**
+ * The SWAR kernel needs 64-bit, little-endian longs, and a couple of
+ * GCC builtins. The SIMD kernel also needs per-function target
+ * attributes, so that it can be picked at runtime.
+ */
+#if !defined(USE_C) && defined(__GNUC__) && ULONG_MAX > 0xffffffffUL && \
+    defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define USE_SWAR
+#endif
+
+#if defined(USE_SWAR) && defined(__x86_64__) && \
+    (defined(__clang__) || __GNUC__ >= 5)
+#define USE_SIMD
+#include <immintrin.h>
+#endif
 
 /**
  * A simple C implementation of atoi(3) using no standard
@@ -117,19 +176,1395 @@ int my_atoi_ltr(char *str)
 	return n;
 }
 
-int main(int argc, char *argv[])
+/**
+ * Skip leading whitespace, and handle the sign and the "0x" prefix,
+ * which must be followed by a hex digit.
+ *
+ * Returns the offset of the first digit.
+ */
+size_t parse_prefix(const char *str, size_t len, int *neg, unsigned long *base)
+{
+	size_t i = 0;
+
+	while (i < len && (str[i] == ' ' || (str[i] >= '\t' && str[i] <= '\r')))
+		i++;
+
+	*neg = 0;
+	if (i < len && (str[i] == '-' || str[i] == '+'))
+		*neg = (str[i++] == '-');
+
+	*base = 10;
+	if (len - i > 2 && str[i] == '0' && (str[i + 1] | 0x20) == 'x' &&
+	    ((str[i + 2] >= '0' && str[i + 2] <= '9') ||
+	     ((str[i + 2] | 0x20) >= 'a' && (str[i + 2] | 0x20) <= 'f'))) {
+		*base = 16;
+		i    += 2;
+	}
+
+	return i;
+}
+
+/**
+ * A single-pass, length-bounded parser
+ *
+ * The functions above make two or three passes over the string, write
+ * to it, and overflow silently. Here, we make one pass over at most len
+ * bytes, without writing to the input. This handles leading whitespace,
+ * a sign, and an explicit "0x" (or "0X") prefix for hexadecimal. Without
+ * the prefix, the number is decimal.
+ *
+ * The magnitude is accumulated as an unsigned long, and checked against
+ * the limit for the sign before each digit is added, so that LONG_MIN
+ * can be parsed too. On overflow, we keep consuming digits (as strtol()
+ * does), and clamp the result.
+ *
+ * Returns:
+ *     -EINVAL if no digits were found (*consumed is 0)
+ *     -ERANGE on overflow (*value is LONG_MAX or LONG_MIN)
+ *     0       otherwise
+ *
+ *     In any case, *consumed is the number of bytes used.
+ */
+int parse_long(const char *str, size_t len, long *value, size_t *consumed)
+{
+	unsigned long n = 0, limit = LONG_MAX, base = 10, d;
+	size_t i, start;
+	int neg, overflow = 0;
+
+	*value = 0; *consumed = 0;
+	if (!str) return -EINVAL;
+
+	i = parse_prefix(str, len, &neg, &base);
+	if (neg) limit = (unsigned long)LONG_MAX + 1;
+
+	/* Do the actual conversion */
+	for (start=i;i<len;i++) {
+		if (str[i] >= '0' && str[i] <= '9')
+			d = (unsigned long)(str[i] - '0');
+		else if (base == 16 && (str[i] | 0x20) >= 'a' && (str[i] | 0x20) <= 'f')
+			d = (unsigned long)((str[i] | 0x20) - 'a' + 10);
+		else break;
+
+		if (n > (limit - d) / base) overflow = 1;
+		else n = n * base + d;
+	}
+
+	if (i == start) return -EINVAL;
+	*consumed = i;
+
+	if (overflow) {
+		*value = neg ? LONG_MIN : LONG_MAX;
+		return -ERANGE;
+	}
+
+	*value = neg ? (long)(0 - n) : (long)n;
+	return 0;
+}
+
+/**
+ * Explicit-radix parsing
+ *
+ * parse_long() has to guess the base from a "0x" prefix, and the
+ * functions above guess from whether any of a-f appear, which misreads
+ * hex-looking decimal data. parse_radix() instead takes the base (2 to
+ * 36), and otherwise behaves like parse_long(). For base 16, an optional
+ * "0x" prefix is skipped.
+ *
+ * The parser body is a macro, so that bases 2, 8, 10, and 16 each get a
+ * copy with the base as a constant: the compiler turns the overflow
+ * cutoff division into a multiply or a shift, for powers of two the
+ * digits are shifted in rather than multiplied, and the leading digits
+ * which can't overflow skip the overflow check. Other bases share a
+ * generic copy, which checks every digit. Digit values come from a
+ * table, in which anything that isn't a digit in any base is 255.
+ */
+#define X 255
+const unsigned char digit_value[256] = {
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  X,  X,  X,  X,  X,  X,
+	 X, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+	25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,  X,  X,  X,  X,  X,
+	 X, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+	25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	 X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X
+};
+#undef X
+
+/**
+ * Define a parser for BASE, which is a power of two if SHIFT is non-zero,
+ * and for which the first SAFE digits can't overflow. After those,
+ * overflow is checked against limit / BASE, and limit % BASE for the last
+ * digit, so no division is needed per digit.
+ */
+#define PARSE_RADIX(NAME, BASE, SHIFT, SAFE)                              \
+int NAME(const char *str, size_t len, int base, long *value,              \
+         size_t *consumed)                                                \
+{                                                                         \
+	unsigned long n = 0, limit = LONG_MAX, cutoff, cutlim, d;                \
+	size_t i = 0, start, stop;                                               \
+	int neg = 0, overflow = 0;                                               \
+	                                                                         \
+	(void)base;                                                              \
+	*value = 0; *consumed = 0;                                               \
+	if (!str) return -EINVAL;                                                \
+	                                                                         \
+	while (i < len && (str[i] == ' ' ||                                      \
+	       (str[i] >= '\t' && str[i] <= '\r')))                              \
+		i++;                                                                    \
+	                                                                         \
+	if (i < len && (str[i] == '-' || str[i] == '+'))                         \
+		neg = (str[i++] == '-');                                                \
+	                                                                         \
+	if ((BASE) == 16 && len - i > 2 && str[i] == '0' &&                      \
+	    (str[i + 1] | 0x20) == 'x' &&                                        \
+	    digit_value[(unsigned char)str[i + 2]] < 16)                         \
+		i += 2;                                                                 \
+	                                                                         \
+	/* The first SAFE digits can't overflow, so skip the checks */           \
+	stop = len - i > (size_t)(SAFE) ? i + (size_t)(SAFE) : len;              \
+	for (start=i;i<stop;i++) {                                               \
+		d = digit_value[(unsigned char)str[i]];                                 \
+		if (d >= (unsigned long)(BASE)) break;                                  \
+		n = (SHIFT) ? (n << (SHIFT)) | d : n * (unsigned long)(BASE) + d;       \
+	}                                                                        \
+	                                                                         \
+	if (neg) limit = (unsigned long)LONG_MAX + 1;                            \
+	cutoff = limit / (unsigned long)(BASE);                                  \
+	cutlim = limit % (unsigned long)(BASE);                                  \
+	                                                                         \
+	for (;i==stop && i<len;i++,stop++) {                                     \
+		d = digit_value[(unsigned char)str[i]];                                 \
+		if (d >= (unsigned long)(BASE)) break;                                  \
+	                                                                         \
+		if (n > cutoff || (n == cutoff && d > cutlim)) overflow = 1;            \
+		else n = (SHIFT) ? (n << (SHIFT)) | d : n * (unsigned long)(BASE) + d;  \
+	}                                                                        \
+	                                                                         \
+	if (i == start) return -EINVAL;                                          \
+	*consumed = i;                                                           \
+	                                                                         \
+	if (overflow) {                                                          \
+		*value = neg ? LONG_MIN : LONG_MAX;                                     \
+		return -ERANGE;                                                         \
+	}                                                                        \
+	                                                                         \
+	*value = neg ? (long)(0 - n) : (long)n;                                  \
+	return 0;                                                                \
+}
+
+/* Digits of each base that always fit in a long */
+#define LONG_BITS (sizeof(long) * CHAR_BIT - 1)
+
+PARSE_RADIX(parse_radix2, 2, 1, LONG_BITS)
+PARSE_RADIX(parse_radix8, 8, 3, LONG_BITS / 3)
+PARSE_RADIX(parse_radix10, 10, 0, LONG_BITS * 3 / 10)
+PARSE_RADIX(parse_radix16, 16, 4, LONG_BITS / 4)
+PARSE_RADIX(parse_radix_generic, base, 0, 0)
+
+/**
+ * Parse a number in the given base, from 2 to 36.
+ *
+ * Returns:
+ *     -EINVAL if the base is out of range, or no digits were found
+ *     -ERANGE on overflow (*value is LONG_MAX or LONG_MIN)
+ *     0       otherwise
+ *
+ *     In any case, *consumed is the number of bytes used.
+ */
+int parse_radix(const char *str, size_t len, int base, long *value,
+                size_t *consumed)
 {
+	switch (base) {
+		case 2:  return parse_radix2(str, len, base, value, consumed);
+		case 8:  return parse_radix8(str, len, base, value, consumed);
+		case 10: return parse_radix10(str, len, base, value, consumed);
+		case 16: return parse_radix16(str, len, base, value, consumed);
+	}
+
+	if (base < 2 || base > 36) {
+		*value = 0; *consumed = 0;
+		return -EINVAL;
+	}
+
+	return parse_radix_generic(str, len, base, value, consumed);
+}
+
+#ifdef USE_SWAR
+/**
+ * Bulk digit parsing kernels
+ *
+ * Each of these validates and converts a run of up to 8 (SWAR) or 16
+ * (SSE4.1) decimal or hex digits at once, returning the number of
+ * digits found, and their value in *v. parse_long_fast() strings these
+ * runs together.
+ *
+ * The digits are right-aligned in the register (the bytes shifted in
+ * are leading zeros), then adjacent digits are combined pairwise:
+ * digits into 2-digit values, those into 4-digit values, and so on.
+ * This takes log2(n) multiply-adds rather than n.
+ */
+
+/* A one in every byte, and the high bit of each byte */
+#define ONES  (~0UL / 255)
+#define HIGHS (ONES * 0x80)
+
+/* The low byte of each 16-bit lane, and the low word of each 32-bit lane */
+#define LANES16 (ONES / 0x101 * 0xff)
+#define LANES32 (ONES / 0x1010101 * 0xffff)
+
+/**
+ * Set the high bit of each byte in x which is strictly between m and n.
+ * (See Sean Anderson's "Bit Twiddling Hacks".)
+ */
+#define HAS_BETWEEN(X, M, N) \
+	(((ONES * (127 + (N)) - ((X) & ONES * 127)) & ~(X) & \
+	  (((X) & ONES * 127) + ONES * (127 - (M)))) & HIGHS)
+
+/* Powers of 10, for joining runs of digits */
+unsigned long pow10_table[] = {
+	1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL,
+	100000000UL, 1000000000UL, 10000000000UL, 100000000000UL,
+	1000000000000UL, 10000000000000UL, 100000000000000UL,
+	1000000000000000UL, 10000000000000000UL, 100000000000000000UL,
+	1000000000000000000UL, 10000000000000000000UL
+};
+
+/**
+ * Convert up to 8 digits with SWAR (SIMD Within A Register.)
+ */
+int digits_swar(const char *p, size_t len, int hex, unsigned long *v)
+{
+	unsigned long x = 0, valid;
 	int n;
 
+	memcpy(&x, p, len < 8 ? len : 8);
+	valid = HAS_BETWEEN(x, '0' - 1, '9' + 1);
+	if (hex) valid |= HAS_BETWEEN(x | ONES * 0x20, 'a' - 1, 'f' + 1);
+	if (!(n = (~valid & HIGHS) ? __builtin_ctzl(~valid & HIGHS) >> 3 : 8))
+		return 0;
+
+	/* Digit values, with 'a' - 'f' (either case) mapped to 10 - 15 */
+	x = (x & ONES * 0x0f) + 9 * ((x >> 6) & ONES);
+	x <<= 8 * (8 - n);
+
+	if (hex) {
+		x = ((x & LANES16) << 4)  + ((x >> 8)  & LANES16);
+		x = ((x & LANES32) << 8)  + ((x >> 16) & LANES32);
+		*v = ((x & 0xffffffffUL) << 16) + (x >> 32);
+	} else {
+		x = (x & LANES16) * 10    + ((x >> 8)  & LANES16);
+		x = (x & LANES32) * 100   + ((x >> 16) & LANES32);
+		*v = (x & 0xffffffffUL) * 10000 + (x >> 32);
+	}
+
+	return n;
+}
+
+#ifdef USE_SIMD
+/**
+ * pshufb masks which right-align the first n bytes of a vector, zeroing
+ * the rest: the mask for n starts at shift_table + n.
+ */
+unsigned char shift_table[32] = {
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+/**
+ * Convert up to 16 digits with SSE4.1.
+ *
+ * pmaddubsw and pmaddwd do the pairwise multiply-adds. Hex values of 4
+ * digits don't fit in pmaddwd's signed words, so those are put together
+ * with shifts instead.
+ */
+__attribute__((target("sse4.1")))
+int digits_sse41(const char *p, size_t len, int hex, unsigned long *v)
+{
+	char tmp[16];
+	__m128i c, d, l, m;
+	unsigned long x;
+	int n;
+
+	/* Don't read past the end of the buffer */
+	if (len < 16) {
+		memset(tmp, 0, sizeof(tmp));
+		memcpy(tmp, p, len);
+		p = tmp;
+	}
+
+	c = _mm_loadu_si128((const __m128i *)p);
+	d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+	m = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+
+	if (hex) {
+		l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+		                 _mm_set1_epi8('a'));
+		c = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+		d = _mm_blendv_epi8(d, _mm_add_epi8(l, _mm_set1_epi8(10)), c);
+		m = _mm_or_si128(m, c);
+	}
+
+	if (!(n = __builtin_ctz(~_mm_movemask_epi8(m) | 0x10000)))
+		return 0;
+
+	d = _mm_shuffle_epi8(d, _mm_loadu_si128((const __m128i *)(shift_table + n)));
+	if (hex) {
+		d = _mm_maddubs_epi16(d, _mm_set1_epi16(0x0110));
+		d = _mm_madd_epi16(d, _mm_set1_epi32(0x00010100));
+		x = (unsigned long)_mm_cvtsi128_si64(_mm_packus_epi32(d, d));
+		*v = (x << 48) | ((x & 0xffff0000UL) << 16) |
+		     ((x >> 16) & 0xffff0000UL) | (x >> 48);
+	} else {
+		d = _mm_maddubs_epi16(d, _mm_set1_epi16(0x010a));
+		d = _mm_madd_epi16(d, _mm_set1_epi32(0x00010064));
+		d = _mm_madd_epi16(_mm_packus_epi32(d, d), _mm_set1_epi32(0x00012710));
+		*v = (unsigned long)(unsigned int)_mm_cvtsi128_si32(d) * 100000000UL +
+		     (unsigned long)(unsigned int)_mm_extract_epi32(d, 1);
+	}
+
+	return n;
+}
+#endif /* USE_SIMD */
+
+/**
+ * The available kernels, and how many digits each converts at a time.
+ * 'usable' is filled in by digits_init(), according to what the CPU
+ * supports.
+ */
+struct digits_kernel {
+	const char *name;
+	int (*fn)(const char *, size_t, int, unsigned long *);
+	int width;
+	int usable;
+};
+
+struct digits_kernel digits_kernels[] = {
+	{ "swar",   digits_swar,  8,  1 },
+	#ifdef USE_SIMD
+	{ "sse4.1", digits_sse41, 16, 0 },
+	#endif
+	{ NULL,     NULL,         0,  0 }
+};
+
+/* The kernel picked by digits_init() */
+struct digits_kernel *digits_best = NULL;
+
+/**
+ * Check which kernels the CPU supports, and pick the widest one.
+ */
+void digits_init(void)
+{
+	struct digits_kernel *k;
+
+	#ifdef USE_SIMD
+	__builtin_cpu_init();
+	digits_kernels[1].usable = __builtin_cpu_supports("sse4.1");
+	#endif
+
+	for (k=digits_kernels;k->name;k++)
+		if (k->usable) digits_best = k;
+}
+
+/**
+ * Append a run of k digits to n, checking against limit.
+ *
+ * Returns 1 on overflow, 0 otherwise.
+ */
+int append_digits(unsigned long *n, unsigned long run, int k,
+                  unsigned long base, unsigned long limit)
+{
+	unsigned long scale;
+
+	if (run > limit) return 1;
+	if (!*n) {
+		*n = run;
+		return 0;
+	}
+
+	if (base == 16) {
+		if (k >= 16) return 1;
+		scale = 1UL << (4 * k);
+	} else scale = pow10_table[k];
+
+	if (*n > (limit - run) / scale) return 1;
+	*n = *n * scale + run;
+	return 0;
+}
+
+/**
+ * The same as parse_long(), converting the digits with the widest
+ * kernel the CPU supports.
+ */
+int parse_long_fast(const char *str, size_t len, long *value, size_t *consumed)
+{
+	unsigned long n = 0, limit = LONG_MAX, base, run;
+	size_t i, start;
+	int neg, k, overflow = 0;
+
+	*value = 0; *consumed = 0;
+	if (!str) return -EINVAL;
+	if (!digits_best) digits_init();
+
+	i = parse_prefix(str, len, &neg, &base);
+	if (neg) limit = (unsigned long)LONG_MAX + 1;
+
+	/* A run shorter than the kernel's width ends the number */
+	for (start=i;i<len;i+=(size_t)k) {
+		if (!(k = digits_best->fn(str + i, len - i, base == 16, &run)))
+			break;
+
+		if (!overflow) overflow = append_digits(&n, run, k, base, limit);
+		if (k < digits_best->width) {
+			i += (size_t)k;
+			break;
+		}
+	}
+
+	if (i == start) return -EINVAL;
+	*consumed = i;
+
+	if (overflow) {
+		*value = neg ? LONG_MIN : LONG_MAX;
+		return -ERANGE;
+	}
+
+	*value = neg ? (long)(0 - n) : (long)n;
+	return 0;
+}
+#else
+/* Without the kernels, there's nothing faster than parse_long() */
+#define parse_long_fast parse_long
+#endif /* USE_SWAR */
+
+/**
+ * Find the first delimiter in a buffer
+ *
+ * Returns its offset, or len if there isn't one.
+ */
+size_t find_delim_scalar(const char *p, size_t len)
+{
+	size_t i;
+	for (i=0;i<len && !IS_DELIM(p[i]);i++);
+	return i;
+}
+
+#ifdef USE_SIMD
+/**
+ * The same as find_delim_scalar(), comparing 16 or 32 bytes at once
+ * against each delimiter.
+ */
+#define FIND_DELIM_SIMD(TYPE, W, LOAD, SET1, CMPEQ, OR, MOVEMASK)  \
+	size_t i = 0; TYPE c, m; unsigned int bits;                    \
+	                                                               \
+	for (;len-i>=W;i+=W) {                                         \
+		c = LOAD((const TYPE *)(p + i));                           \
+		m = OR(OR(CMPEQ(c, SET1(',')), CMPEQ(c, SET1(' '))),       \
+		       OR(OR(CMPEQ(c, SET1('\n')), CMPEQ(c, SET1('\r'))),  \
+		          CMPEQ(c, SET1('\t'))));                          \
+		if ((bits = (unsigned int)MOVEMASK(m)) != 0)               \
+			return i + (size_t)__builtin_ctz(bits);                \
+	}                                                              \
+	                                                               \
+	return i + find_delim_scalar(p + i, len - i)
+
+__attribute__((target("sse2")))
+size_t find_delim_sse2(const char *p, size_t len)
+{
+	FIND_DELIM_SIMD(__m128i, 16, _mm_loadu_si128, _mm_set1_epi8,
+	                _mm_cmpeq_epi8, _mm_or_si128, _mm_movemask_epi8);
+}
+
+__attribute__((target("avx2")))
+size_t find_delim_avx2(const char *p, size_t len)
+{
+	FIND_DELIM_SIMD(__m256i, 32, _mm256_loadu_si256, _mm256_set1_epi8,
+	                _mm256_cmpeq_epi8, _mm256_or_si256, _mm256_movemask_epi8);
+}
+#endif /* USE_SIMD */
+
+/* The delimiter search picked by find_delim_init() */
+size_t (*find_delim)(const char *, size_t) = NULL;
+
+/**
+ * Pick the widest delimiter search the CPU supports.
+ */
+void find_delim_init(void)
+{
+	find_delim = find_delim_scalar;
+
+	#ifdef USE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) find_delim = find_delim_sse2;
+	if (__builtin_cpu_supports("avx2")) find_delim = find_delim_avx2;
+	#endif
+}
+
+/**
+ * A field which couldn't be parsed.
+ *
+ * error is -EINVAL if the field isn't a number (it's stored as 0), or
+ * -ERANGE if it overflowed (it's clamped.)
+ */
+struct field_error {
+	size_t index;
+	int    error;
+};
+
+/**
+ * Count the fields in a buffer.
+ */
+size_t count_fields(const char *buf, size_t len)
+{
+	size_t i = 0, n = 0;
+
+	if (!find_delim) find_delim_init();
+	while (i < len) {
+		if (IS_DELIM(buf[i])) { i++; continue; }
+		i += find_delim(buf + i, len - i);
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Parse a buffer of delimited numbers in bulk
+ *
+ * Calling atoi() once per field means scanning each field twice (once
+ * to find its end, once to convert it), plus the call overhead. Here,
+ * we find the end of each field with the widest delimiter search the
+ * CPU supports, and convert it with parse_long_fast(), straight into a
+ * dense array of up to max_out values.
+ *
+ * Fields are separated by any run of commas, spaces, tabs, and line
+ * breaks. Any field which isn't entirely a number, or overflows, is
+ * recorded in errors[] by its index (counting from first_index), up to
+ * max_errors of them. *n_errors is the total number of bad fields.
+ *
+ * Returns the number of fields parsed.
+ */
+size_t parse_fields(const char *buf, size_t len, long *out, size_t max_out,
+                    size_t first_index, struct field_error *errors,
+                    size_t max_errors, size_t *n_errors)
+{
+	size_t i = 0, n = 0, end, used;
+	int ret;
+
+	*n_errors = 0;
+	if (!find_delim) find_delim_init();
+
+	while (i < len && n < max_out) {
+		if (IS_DELIM(buf[i])) { i++; continue; }
+		end = i + find_delim(buf + i, len - i);
+
+		ret = parse_long_fast(buf + i, end - i, &out[n], &used);
+		if (!ret && used != end - i) ret = -EINVAL;
+		if (ret) {
+			if (ret == -EINVAL) out[n] = 0;
+			if (*n_errors < max_errors) {
+				errors[*n_errors].index = first_index + n;
+				errors[*n_errors].error = ret;
+			}
+			(*n_errors)++;
+		}
+
+		n++;
+		i = end;
+	}
+
+	return n;
+}
+
+/**
+ * One thread's share of parse_fields_parallel().
+ */
+struct fields_job {
+	const char         *buf;
+	size_t              len;
+	long               *out;
+	size_t              max_out;
+	size_t              first;
+	size_t              count;
+	struct field_error *errors;
+	size_t              max_errors;
+	size_t              n_errors;
+	int                 parse;
+};
+
+/**
+ * Count the fields in a segment, or parse them.
+ */
+void *fields_worker(void *arg)
+{
+	struct fields_job *job = arg;
+
+	if (!job->parse) job->count = count_fields(job->buf, job->len);
+	else job->count = parse_fields(job->buf, job->len, job->out,
+	                               job->max_out, job->first, job->errors,
+	                               job->max_errors, &job->n_errors);
+	return NULL;
+}
+
+/**
+ * Run each job in its own thread (the caller takes the first one.)
+ */
+void run_jobs(struct fields_job *jobs, int threads)
+{
+	int i;
+	#ifdef USE_POSIX
+	pthread_t tids[MAX_THREADS];
+
+	for (i=1;i<threads;i++) {
+		if (pthread_create(&tids[i], NULL, fields_worker, &jobs[i]))
+			tids[i] = pthread_self();
+	}
+
+	fields_worker(&jobs[0]);
+	for (i=1;i<threads;i++) {
+		if (pthread_equal(tids[i], pthread_self()))
+			fields_worker(&jobs[i]);
+		else pthread_join(tids[i], NULL);
+	}
+	#else
+	for (i=0;i<threads;i++) fields_worker(&jobs[i]);
+	#endif
+}
+
+/**
+ * The same as parse_fields(), with several threads
+ *
+ * The buffer is split into roughly equal segments, with each split
+ * moved forward to the next delimiter, so that no field is cut in two.
+ * Each thread counts the fields in its segment, which tells us where
+ * each segment's values go in out[], then each thread parses its
+ * segment straight into its part of out[].
+ *
+ * Returns the number of fields parsed, or (size_t)-1 if there's not
+ * enough memory for the error lists.
+ */
+size_t parse_fields_parallel(const char *buf, size_t len, long *out,
+                             size_t max_out, struct field_error *errors,
+                             size_t max_errors, size_t *n_errors,
+                             int threads)
+{
+	struct fields_job jobs[MAX_THREADS];
+	size_t start = 0, end, first = 0, n = 0, e;
+	int i;
+
+	*n_errors = 0;
+	if (threads < 1)           threads = 1;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+	if (!find_delim) find_delim_init();
+
+	/* Split the buffer, and count the fields in each segment */
+	for (i=0;i<threads;i++) {
+		end = (i == threads - 1) ? len : len / threads * (i + 1);
+		if (end < start) end = start;
+		end += find_delim(buf + end, len - end);
+
+		jobs[i].buf   = buf + start;
+		jobs[i].len   = end - start;
+		jobs[i].parse = 0;
+		start         = end;
+	}
+	run_jobs(jobs, threads);
+
+	/* Work out where each segment's values go */
+	for (i=0;i<threads;i++) {
+		jobs[i].first      = first;
+		jobs[i].out        = out + (first < max_out ? first : max_out);
+		jobs[i].max_out    = first < max_out ? max_out - first : 0;
+		jobs[i].max_errors = max_errors;
+		jobs[i].parse      = 1;
+		first             += jobs[i].count;
+
+		if (!(jobs[i].errors = malloc((max_errors ? max_errors : 1) *
+		                              sizeof(struct field_error)))) {
+			while (i--) free(jobs[i].errors);
+			return (size_t)-1;
+		}
+	}
+	run_jobs(jobs, threads);
+
+	/* Gather up the results, in order */
+	for (i=0;i<threads;i++) {
+		for (e=0;e<jobs[i].n_errors && e<max_errors;e++) {
+			if (*n_errors + e < max_errors)
+				errors[*n_errors + e] = jobs[i].errors[e];
+		}
+
+		*n_errors += jobs[i].n_errors;
+		n         += jobs[i].count;
+		free(jobs[i].errors);
+	}
+
+	return n;
+}
+
+/**
+ * Integer formatting
+ *
+ * The counterpart to the parsers above: format_ulong(), format_long(),
+ * and format_hex() write the digits of a number into buf, and return
+ * how many were written. No NUL is appended, so that numbers can be
+ * packed back to back into an output buffer. buf must have room for
+ * FORMAT_MAX bytes.
+ *
+ * The number of digits is worked out up front, from the position of
+ * the highest set bit, so that the digits can be written backwards
+ * straight into place. Decimal digits are written two at a time, from a
+ * table of the pairs "00" through "99", halving the number of divides.
+ */
+
+/* Enough room for any long, in decimal or hex, with a sign */
+#define FORMAT_MAX (sizeof(long) * CHAR_BIT / 3 + 2)
+
+/* Pairs of decimal digits, "00" through "99" */
+const char digit_pairs[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * Count the decimal digits in v.
+ *
+ * log10(v) is approximated as log2(v) * 1233 / 4096, which can be one
+ * too small, so one comparison against a power of 10 fixes it up.
+ * (See Sean Anderson's "Bit Twiddling Hacks".)
+ */
+int count_digits(unsigned long v)
+{
+	#ifdef USE_SWAR
+	int t = ((64 - __builtin_clzl(v | 1)) * 1233) >> 12;
+	return t + ((v | 1) >= pow10_table[t]);
+	#else
+	int n = 1;
+	while (v >= 100) { v /= 100; n += 2; }
+	return n + (v >= 10);
+	#endif
+}
+
+/**
+ * Count the hex digits in v.
+ */
+int count_hex_digits(unsigned long v)
+{
+	#ifdef USE_SWAR
+	return (64 - __builtin_clzl(v | 1) + 3) >> 2;
+	#else
+	int n = 1;
+	while (v >>= 4) n++;
+	return n;
+	#endif
+}
+
+/**
+ * Write the decimal digits of v into buf.
+ */
+size_t format_ulong(char *buf, unsigned long v)
+{
+	int n = count_digits(v);
+	char *p = buf + n;
+	unsigned long i;
+
+	while (v >= 100) {
+		i  = (v % 100) * 2;
+		v /= 100;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	}
+
+	if (v >= 10) {
+		*--p = digit_pairs[v * 2 + 1];
+		*--p = digit_pairs[v * 2];
+	} else *--p = (char)('0' + v);
+
+	return (size_t)n;
+}
+
+/**
+ * Write v into buf in decimal, with a leading '-' if it's negative.
+ */
+size_t format_long(char *buf, long v)
+{
+	if (v >= 0) return format_ulong(buf, (unsigned long)v);
+
+	/* Negate as unsigned, so that LONG_MIN doesn't overflow */
+	*buf = '-';
+	return format_ulong(buf + 1, 0UL - (unsigned long)v) + 1;
+}
+
+/**
+ * Write the lowercase hex digits of v into buf, without a "0x" prefix.
+ */
+size_t format_hex(char *buf, unsigned long v)
+{
+	int n = count_hex_digits(v);
+	char *p = buf + n;
+
+	do {
+		*--p = hex_digits[v & 15];
+		v >>= 4;
+	} while (p > buf);
+
+	return (size_t)n;
+}
+
+/**
+ * Get the current time in seconds, for benchmarking.
+ */
+double bench_now(void)
+{
+	#ifdef USE_POSIX
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+	#else
+	return (double)clock() / CLOCKS_PER_SEC;
+	#endif
+}
+
+/**
+ * Build a buffer of count random decimal numbers, each terminated by
+ * a NUL byte, for the benchmarks. The numbers fit in an int, so that
+ * every parser can handle them.
+ */
+char *bench_numbers(int count, size_t *len)
+{
+	unsigned long seed = 0x2545f491UL, x;
+	char *buf, *p;
+	int i;
+
+	if (!(buf = malloc((size_t)count * 12))) {
+		fprintf(stderr, "Unable to allocate the benchmark buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (p=buf,i=0;i<count;i++) {
+		seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+		x    = (seed >> 1) >> (seed % 31);
+		p   += sprintf(p, "%lu", x) + 1;
+	}
+
+	*len = (size_t)(p - buf);
+	return buf;
+}
+
+/**
+ * Time each of the parsers over the same numbers, and report the time
+ * taken per number.
+ */
+void benchmark(int count)
+{
+	const char *names[] = { "parse_long", "strtol", "my_atoi_ltr", "my_atoi_rtl" };
+	unsigned long sum;
+	size_t len, used;
+	char *buf, *p;
+	double t;
+	long v;
+	int i;
+
+	buf = bench_numbers(count, &len);
+	printf("%-12s %9s %11s\n", "Parser", "Time (s)", "ns/number");
+	for (i=0;i<4;i++) {
+		t = bench_now();
+		for (sum=0,p=buf;p<buf+len;p+=strlen(p)+1) {
+			switch (i) {
+				case 0: parse_long(p, (size_t)(buf + len - p), &v, &used); break;
+				case 1: v = strtol(p, NULL, 10); break;
+				case 2: v = my_atoi_ltr(p); break;
+				case 3: v = my_atoi_rtl(p); break;
+			}
+			sum += (unsigned long)v;
+		}
+		t = bench_now() - t;
+
+		printf("%-12s %9.6f %11.2f (checksum: %lu)\n", names[i], t,
+		       t * 1e9 / count, sum);
+	}
+
+	free(buf);
+}
+
+/**
+ * Time strtol(), the generic parser, and the specialized parser for
+ * bases 2, 8, 10, and 16, over count random numbers in each base, and
+ * report the time taken per number.
+ */
+void benchmark_radix(int count)
+{
+	const int bases[] = { 2, 8, 10, 16 };
+	unsigned long seed = 0x2545f491UL, sum, x;
+	char *buf, *p, tmp[sizeof(long) * CHAR_BIT], *q;
+	const char *name;
+	size_t len, used;
+	int b, i, j;
+	double t;
+	long v;
+
+	if (!(buf = malloc((size_t)count * (sizeof(long) * CHAR_BIT + 1)))) {
+		fprintf(stderr, "Unable to allocate the benchmark buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-5s %-20s %9s %11s\n", "Base", "Parser", "Time (s)",
+	       "ns/number");
+	for (b=0;b<4;b++) {
+		/* Random non-negative numbers of every length, NUL-terminated */
+		for (p=buf,i=0;i<count;i++) {
+			seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+			x    = seed << 16 << 15;
+			seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+			x   |= seed;
+			x  >>= seed % (sizeof(long) * CHAR_BIT - 1);
+
+			q = tmp + sizeof(tmp);
+			do {
+				*--q = "0123456789abcdef"[x % (unsigned long)bases[b]];
+				x   /= (unsigned long)bases[b];
+			} while (x);
+
+			memcpy(p, q, (size_t)(tmp + sizeof(tmp) - q));
+			p   += tmp + sizeof(tmp) - q;
+			*p++ = '\0';
+		}
+		len = (size_t)(p - buf);
+
+		for (j=0;j<3;j++) {
+			t = bench_now();
+			for (sum=0,p=buf;p<buf+len;p+=used+1) {
+				switch (j) {
+					case 0:
+						v    = strtol(p, &q, bases[b]);
+						used = (size_t)(q - p);
+						break;
+					case 1:
+						parse_radix_generic(p, (size_t)(buf + len - p),
+						                    bases[b], &v, &used);
+						break;
+					default:
+						parse_radix(p, (size_t)(buf + len - p), bases[b],
+						            &v, &used);
+						break;
+				}
+				sum += (unsigned long)v;
+			}
+			t = bench_now() - t;
+
+			name = j == 0 ? "strtol" :
+			       j == 1 ? "parse_radix_generic" : "parse_radix";
+			printf("%-5d %-20s %9.6f %11.2f (checksum: %lu)\n", bases[b],
+			       name, t, t * 1e9 / count, sum);
+		}
+	}
+
+	free(buf);
+}
+
+/**
+ * Time sprintf(), snprintf(), and the formatters over count random
+ * numbers of every length, and report the time taken per number. The
+ * output of each formatter is checked against sprintf()'s.
+ *
+ * snprintf() is C99, so without USE_POSIX its row is sprintf() again.
+ */
+void benchmark_format(int count)
+{
+	const char *names[] = { "sprintf", "snprintf", "format_long",
+	                        "sprintf/hex", "format_hex" };
+	unsigned long seed = 0x2545f491UL, x;
+	char *buf, *ref = NULL, *p;
+	size_t len, ref_len = 0;
+	long *nums;
+	double t;
+	int i, j;
+
+	nums = malloc((size_t)count * sizeof(long));
+	buf  = malloc((size_t)count * (FORMAT_MAX + 1));
+	ref  = malloc((size_t)count * (FORMAT_MAX + 1));
+	if (!nums || !buf || !ref) {
+		fprintf(stderr, "Unable to allocate the benchmark buffers!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Shift out a random number of bits, to get every length */
+	for (i=0;i<count;i++) {
+		seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+		x    = seed << 16 << 16;
+		seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+		x   |= seed;
+		nums[i] = (long)(x >> (seed % (sizeof(long) * CHAR_BIT)));
+	}
+
+	printf("%-12s %9s %11s\n", "Formatter", "Time (s)", "ns/number");
+	for (j=0;j<5;j++) {
+		t = bench_now();
+		for (p=buf,i=0;i<count;i++) {
+			switch (j) {
+				case 0: p += sprintf(p, "%ld", nums[i]); break;
+				#ifdef USE_POSIX
+				case 1: p += snprintf(p, FORMAT_MAX + 1, "%ld", nums[i]); break;
+				#else
+				case 1: p += sprintf(p, "%ld", nums[i]); break;
+				#endif
+				case 2: p += format_long(p, nums[i]); break;
+				case 3: p += sprintf(p, "%lx", (unsigned long)nums[i]); break;
+				case 4: p += format_hex(p, (unsigned long)nums[i]); break;
+			}
+			*p++ = '\n';
+		}
+		t = bench_now() - t;
+		len = (size_t)(p - buf);
+
+		/* sprintf() is the reference for each group of rows */
+		if (j == 0 || j == 3) memcpy(ref, buf, ref_len = len);
+		printf("%-12s %9.6f %11.2f (%lu bytes%s)\n", names[j], t,
+		       t * 1e9 / count, (unsigned long)len,
+		       len == ref_len && !memcmp(buf, ref, len) ? "" : ", MISMATCH");
+	}
+
+	free(nums);
+	free(ref);
+	free(buf);
+}
+
+/**
+ * Build a buffer of count newline-terminated fields, with 1 to 18
+ * random digits each (decimal, or hex with a "0x" prefix.)
+ */
+char *bench_fields(int count, int hex, size_t *len)
+{
+	unsigned long seed = 0x2545f491UL;
+	char *buf, *p;
+	int i, j, n;
+
+	if (!(buf = malloc((size_t)count * 21 + 1))) {
+		fprintf(stderr, "Unable to allocate the benchmark buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (p=buf,i=0;i<count;i++) {
+		seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+		n    = 1 + (int)((seed >> 16) % (hex ? 15 : 18));
+		if (hex) { *p++ = '0'; *p++ = 'x'; }
+
+		for (j=0;j<n;j++) {
+			seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+			*p++ = "0123456789abcdef"[(seed >> 16) % (hex ? 16 : 10)];
+		}
+		*p++ = '\n';
+	}
+
+	*p   = '\0';
+	*len = (size_t)(p - buf);
+	return buf;
+}
+
+/**
+ * Time parse_fields(), and parse_fields_parallel() with 2 up to the
+ * given number of threads (doubling each step), over a buffer of count
+ * fields.
+ */
+void benchmark_batch(const char *buf, size_t len, int count,
+                     const char *label, int threads)
+{
+	struct field_error errors[1];
+	size_t i, n, n_errors;
+	unsigned long sum;
+	char name[32];
+	long *out;
+	double t;
+	int th;
+
+	if (!(out = malloc((size_t)count * sizeof(long)))) {
+		fprintf(stderr, "Unable to allocate the output array!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (th=1;th<=threads;th=(th*2>threads && th<threads) ? threads : th*2) {
+		t = bench_now();
+		if (th == 1) {
+			strcpy(name, "parse_fields");
+			n = parse_fields(buf, len, out, (size_t)count, 0,
+			                 errors, 1, &n_errors);
+		} else {
+			sprintf(name, "parse_fields/%d", th);
+			n = parse_fields_parallel(buf, len, out, (size_t)count,
+			                          errors, 1, &n_errors, th);
+		}
+		t = bench_now() - t;
+
+		if (n == (size_t)-1) {
+			fprintf(stderr, "Unable to allocate the error lists!\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for (sum=0,i=0;i<n;i++) sum += (unsigned long)out[i];
+		printf("%-6s %-22s %9.6f %9.3f %11.2f (checksum: %lu)\n",
+		       label, name, t, t > 0 ? (double)len / t / 1e9 : 0.0,
+		       t * 1e9 / count, sum);
+	}
+
+	free(out);
+}
+
+/**
+ * Time strtol(), parse_long(), parse_long_fast() with each of the
+ * kernels, and the batch parsers, over random-length fields, and report
+ * the throughput.
+ */
+void benchmark_fields(int count, int threads)
+{
+	char name[32], *buf, *p, *end;
+	unsigned long sum;
+	size_t len, used;
+	int hex, i;
+	double t;
+	long v;
+	#ifdef USE_SWAR
+	struct digits_kernel *best;
+
+	if (!digits_best) digits_init();
+	best = digits_best;
+	#endif
+
+	printf("%-6s %-22s %9s %9s %11s\n",
+	       "Fields", "Parser", "Time (s)", "GB/s", "ns/number");
+	for (hex=0;hex<2;hex++) {
+		buf = bench_fields(count, hex, &len);
+
+		for (i=0;;i++) {
+			if (i == 0)      strcpy(name, "strtol");
+			else if (i == 1) strcpy(name, "parse_long");
+			#ifdef USE_SWAR
+			else if (digits_kernels[i - 2].usable) {
+				digits_best = &digits_kernels[i - 2];
+				sprintf(name, "parse_long_fast/%s", digits_best->name);
+			} else if (digits_kernels[i - 2].name) continue;
+			#endif
+			else break;
+
+			t = bench_now();
+			for (sum=0,p=buf;p<buf+len;p=end+1) {
+				if (!i) v = strtol(p, &end, hex ? 16 : 10);
+				else {
+					if (i == 1) parse_long(p, (size_t)(buf + len - p), &v, &used);
+					else parse_long_fast(p, (size_t)(buf + len - p), &v, &used);
+					end = p + used;
+				}
+				sum += (unsigned long)v;
+			}
+			t = bench_now() - t;
+
+			printf("%-6s %-22s %9.6f %9.3f %11.2f (checksum: %lu)\n",
+			       hex ? "hex" : "dec", name, t,
+			       t > 0 ? (double)len / t / 1e9 : 0.0, t * 1e9 / count, sum);
+		}
+
+		#ifdef USE_SWAR
+		digits_best = best;
+		#endif
+		benchmark_batch(buf, len, count, hex ? "hex" : "dec", threads);
+		free(buf);
+	}
+}
+
+/**
+ * Parse a file of delimited numbers with parse_fields_parallel(), and
+ * report the sum of the numbers, any bad fields, and the throughput.
+ *
+ * The file is parsed in batches of about FILE_BATCH bytes, split at a
+ * delimiter, so that the output array stays the same size however big
+ * the file is.
+ *
+ * With USE_POSIX, the file is mapped into memory rather than read.
+ */
+int parse_file(const char *path, int threads)
+{
+	struct field_error errors[10], batch_errors[10];
+	size_t len, n = 0, i, n_errors = 0, start, end, count, e;
+	unsigned long sum = 0;
+	char *buf;
+	long *out;
+	double t;
+	#ifdef USE_POSIX
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st)) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	len = (size_t)st.st_size;
+	buf = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if (buf == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	#else
+	FILE *fp;
+
+	if (!(fp = fopen(path, "rb"))) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = (size_t)ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (!(buf = malloc(len ? len : 1)) || fread(buf, 1, len, fp) != len) {
+		fprintf(stderr, "Unable to read %s!\n", path);
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+	fclose(fp);
+	#endif
+
+	/*
+	 * Every field takes at least two bytes, save for the last one. A
+	 * batch only runs past FILE_BATCH to finish its last field.
+	 */
+	t = bench_now();
+	if (!(out = malloc((FILE_BATCH / 2 + 1) * sizeof(long)))) {
+		fprintf(stderr, "Unable to allocate the output array!\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!find_delim) find_delim_init();
+	for (start=0;start<len;start=end) {
+		end = len - start > FILE_BATCH ? start + FILE_BATCH : len;
+		end += find_delim(buf + end, len - end);
+
+		count = parse_fields_parallel(buf + start, end - start, out,
+		                              FILE_BATCH / 2 + 1, batch_errors,
+		                              sizeof(batch_errors) /
+		                              sizeof(batch_errors[0]),
+		                              &e, threads);
+		if (count == (size_t)-1) {
+			fprintf(stderr, "Unable to allocate the error lists!\n");
+			free(out);
+			return EXIT_FAILURE;
+		}
+
+		/* Keep the first few errors, numbered across the whole file */
+		for (i=0;i<e && n_errors+i<sizeof(errors)/sizeof(errors[0]);i++) {
+			errors[n_errors + i]        = batch_errors[i];
+			errors[n_errors + i].index += n;
+		}
+
+		for (i=0;i<count;i++) sum += (unsigned long)out[i];
+		n        += count;
+		n_errors += e;
+	}
+	t = bench_now() - t;
+
+	for (i=0;i<n_errors && i<sizeof(errors)/sizeof(errors[0]);i++) {
+		printf("Field %lu: %s\n", (unsigned long)errors[i].index,
+		       errors[i].error == -ERANGE ? "Out of range" : "Not a number");
+	}
+
+	printf("Parsed %lu fields (%lu bad), sum: %ld\n", (unsigned long)n,
+	       (unsigned long)n_errors, (long)sum);
+	printf("%lu bytes in %.6f s (%.3f GB/s, %.2f ns/number)\n",
+	       (unsigned long)len, t, t > 0 ? (double)len / t / 1e9 : 0.0,
+	       n ? t * 1e9 / n : 0.0);
+
+	free(out);
+	#ifdef USE_POSIX
+	if (len) munmap(buf, len);
+	#else
+	free(buf);
+	#endif
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int n, threads = 1;
+	long l;
+	size_t used;
+
 	/* Check arguments */
 	if (argc < 2 || !argv[1]) {
 		printf("%s <number>\n", argv[0]);
+		printf("%s -b [count]\n", argv[0]);
 		printf("Convert an number represented in ASCII to an integer\n");
 		printf("\tnumber: A number to convert\n");
+		printf("%s -bf [count [threads]]\n", argv[0]);
+		printf("%s -f <file> [threads]\n", argv[0]);
+		printf("%s -r <base> <number>\n", argv[0]);
+		printf("%s -br [count]\n", argv[0]);
+		printf("%s -bi [count]\n", argv[0]);
+		printf("\t-b:     Benchmark the parsers over count numbers\n");
+		printf("\t-bf:    Benchmark the digit kernels over count "
+		       "random-length fields\n");
+		printf("\t-f:     Parse a file of delimited numbers\n");
+		printf("\t-r:     Parse a number in the given base (2 - 36)\n");
+		printf("\t-br:    Benchmark the radix parsers over count numbers\n");
+		printf("\t-bi:    Benchmark the formatters over count numbers\n");
 		exit(EXIT_FAILURE);
 	}
 
-	/* Do it */
+	if (!strcmp(argv[1], "-b")) {
+		benchmark(argc > 2 ? atoi(argv[2]) : BENCH_COUNT);
+		return 0;
+	}
+
+	if (!strcmp(argv[1], "-br")) {
+		benchmark_radix(argc > 2 ? atoi(argv[2]) : BENCH_COUNT);
+		return 0;
+	}
+
+	if (!strcmp(argv[1], "-r") && argc > 3) {
+		n = parse_radix(argv[3], strlen(argv[3]), atoi(argv[2]), &l, &used);
+		printf("[RDX] The number was: %ld (hex: 0x%lx), %lu bytes used%s\n",
+		       l, (unsigned long)l, (unsigned long)used,
+		       n == -ERANGE ? " (overflow)" : (n ? " (invalid)" : ""));
+		return n ? EXIT_FAILURE : 0;
+	}
+
+	if (!strcmp(argv[1], "-bi")) {
+		benchmark_format(argc > 2 ? atoi(argv[2]) : BENCH_COUNT);
+		return 0;
+	}
+
+	#ifdef USE_POSIX
+	threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	#endif
+
+	if (!strcmp(argv[1], "-bf")) {
+		if (argc > 3) threads = atoi(argv[3]);
+		benchmark_fields(argc > 2 ? atoi(argv[2]) : BENCH_COUNT * 10,
+		                 threads < 1 ? 1 : threads);
+		return 0;
+	}
+
+	if (!strcmp(argv[1], "-f") && argc > 2) {
+		if (argc > 3) threads = atoi(argv[3]);
+		return parse_file(argv[2], threads < 1 ? 1 : threads);
+	}
+
+	/* Do it (the single-pass parser first, since the others write) */
+	n = parse_long(argv[1], strlen(argv[1]), &l, &used);
+	printf("[1PS] The number was: %ld (hex: 0x%lx), %lu bytes used%s\n",
+	       l, (unsigned long)l, (unsigned long)used,
+	       n == -ERANGE ? " (overflow)" : (n ? " (no digits)" : ""));
 	n = my_atoi_rtl(argv[1]);
 	printf("[RTL] The number was: %d (hex: 0x%x)\n", n, n);
 	n = my_atoi_ltr(argv[1]);
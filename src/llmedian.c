@@ -5,18 +5,45 @@
  * This code is licenced under the Simplified BSD License.
  * See the LICENSE file for details.
  *
- * Compiling: gcc -ansi -pedantic -Wall -W -O2 -o llmedian llmedian.c
+ * Compiling: gcc -ansi -pedantic -Wall -W -O2 -o llmedian llmedian.c -lm
+ * Defines:
+ *     USE_POSIX: Build lists with several threads, use clock_gettime() for
+ *                the benchmark timer, and report the resident set size
+ *                from /proc/self/statm. Link with -lpthread.
  *
  * Running:
  *     tim@cid ~ $ ./llmedian 5 4
  *     The median node is at position 2
  *     { HEAD }  -> { IPKP }  -> M { DBUO }  -> { FEUK }  -> { FOHX }
+ *     tim@cid ~ $ ./llmedian -b
+ *     Allocator  Build (s)  Traverse (s)  Free (s)  ns/node  RSS (MB)
+ *     ...
  */
+#ifdef USE_POSIX
+#define _XOPEN_SOURCE 600
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
 
+#ifdef USE_POSIX
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+/* Number of nodes for the benchmark */
+#define BENCH_COUNT 10000000
+
+/* Size of the blocks the arena carves nodes from */
+#define ARENA_BLOCK 0x400000
+
+/* Maximum number of threads for build_parallel_list() */
+#define MAX_THREADS 64
+
 /**
  * Quick macro for printing error messages.
  */
@@ -77,19 +104,61 @@ void free_node(struct s_linked_list *list)
 	}
 }
 
+/**
+ * A small PRNG (Marsaglia's 32-bit xorshift), so that each thread can
+ * have its own, rather than sharing rand()'s state.
+ */
+struct prng {
+	unsigned long x;
+};
+
+void prng_seed(struct prng *p, unsigned long seed)
+{
+	p->x = (seed * 2654435761UL + 2463534242UL) & 0xffffffffUL;
+	if (!p->x) p->x = 2463534242UL;
+}
+
+unsigned long prng_next(struct prng *p)
+{
+	unsigned long x = p->x;
+
+	x ^= (x << 13) & 0xffffffffUL;
+	x ^= x >> 17;
+	x ^= (x << 5) & 0xffffffffUL;
+	return p->x = x;
+}
+
+/**
+ * Fill s with n random letters from p
+ */
+void prng_fill(struct prng *p, char *s, int n)
+{
+	int i;
+	for (i=0;i<n;i++) *(s + i) = (char)('A' + prng_next(p) % 25);
+}
+
+/**
+ * Fill s with n random letters
+ */
+void random_fill(char *s, int n)
+{
+	int i;
+	for (i=0;i<n;i++) *(s + i) = (char)('A' + rand() % 25);
+}
+
 /**
  * Create a string of n random letters
  */
 char *random_nchar_string(int n)
 {
-	char *s; int i;
+	char *s;
 
 	if (!(s = calloc(n + 1, sizeof(char)))) {
 		ERROR("random_nchar_string: Out of memory!\n");
 		return NULL;
 	}
 
-	for (i=0;i<n;i++) *(s + i) = (char)('A' + rand() % 25);
+	random_fill(s, n);
 	return s;
 }
 
@@ -113,6 +182,131 @@ struct s_linked_list *build_linked_list(int size, int data_len)
 	return head;
 }
 
+/**
+ * An arena allocator
+ *
+ * Memory is handed out from large blocks, one allocation after the
+ * other, and is only ever freed all at once. So, an allocation is little
+ * more than a pointer bump, nodes built together sit next to each other
+ * in memory, and freeing a list of n nodes is freeing n / 100000 or so
+ * blocks.
+ */
+union arena_align {
+	long   l;
+	double d;
+	void  *p;
+};
+
+#define ARENA_ALIGN sizeof(union arena_align)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;              /* Bytes of data */
+	size_t used;              /* Bytes handed out */
+	union arena_align data[1];
+};
+
+struct arena {
+	struct arena_block *head; /* The block being carved up */
+	size_t total;             /* Bytes allocated, in all blocks */
+	size_t used;              /* Bytes handed out */
+};
+
+void arena_init(struct arena *a)
+{
+	a->head  = NULL;
+	a->total = 0;
+	a->used  = 0;
+}
+
+/**
+ * Allocate size bytes from the arena, aligned for any type. The memory
+ * isn't zeroed.
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_block *b = a->head;
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	if (!b || b->size - b->used < size) {
+		b = malloc(offsetof(struct arena_block, data) +
+		           (size > ARENA_BLOCK ? size : ARENA_BLOCK));
+		if (!b) return NULL;
+
+		b->next  = a->head;
+		b->size  = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+		b->used  = 0;
+		a->head  = b;
+		a->total += b->size;
+	}
+
+	p = (char *)b->data + b->used;
+	b->used += size;
+	a->used += size;
+	return p;
+}
+
+/**
+ * Free everything allocated from the arena.
+ */
+void arena_free(struct arena *a)
+{
+	struct arena_block *b;
+
+	while ((b = a->head)) {
+		a->head = b->next;
+		free(b);
+	}
+
+	a->total = 0;
+	a->used  = 0;
+}
+
+/**
+ * Allocate a node from the arena, with room for len bytes of data (and
+ * a NUL) right after it, so that a node and its data are one allocation,
+ * and share a cache line when they fit.
+ */
+struct s_linked_list *arena_node(struct arena *a, int len)
+{
+	struct s_linked_list *node;
+
+	if (!(node = arena_alloc(a, sizeof(struct s_linked_list) + len + 1))) {
+		ERROR("arena_node: Out of memory!\n");
+		return NULL;
+	}
+
+	node->data = (char *)(node + 1);
+	node->data[len] = '\0';
+	node->next = NULL;
+	return node;
+}
+
+/**
+ * Build a list as build_linked_list() does, but from the arena. The list
+ * is freed with arena_free(), rather than free_node().
+ */
+struct s_linked_list *build_arena_list(struct arena *a, int size,
+                                       int data_len)
+{
+	int i;
+	struct s_linked_list *head, *tail;
+
+	if (!(head = arena_node(a, 4))) {
+		ERROR("build_arena_list: Unable to allocate head!\n");
+		return NULL;
+	}
+
+	memcpy(head->data, "HEAD", 4);
+	for (tail=head,i=1;i<size&&tail;i++,tail=tail->next) {
+		if ((tail->next = arena_node(a, data_len)))
+			random_fill(tail->next->data, data_len);
+	}
+
+	return head;
+}
+
 /**
  * Find the median node
  *
@@ -151,35 +345,1356 @@ void print_list(struct s_linked_list *list, struct s_linked_list *median)
 	printf("\n");
 }
 
-int main(int argc, char *argv[])
+/**
+ * An unrolled linked list
+ *
+ * Each node holds up to UNROLL_K elements, and a count of them, so a
+ * walk over n elements makes n / UNROLL_K pointer hops instead of n, and
+ * the elements of a node share a couple of cache lines. With 64-bit
+ * pointers, a node is 128 bytes.
+ */
+#define UNROLL_K 14
+
+struct s_unrolled_list {
+	int count;
+	char *data[UNROLL_K];
+	struct s_unrolled_list *next;
+};
+
+/**
+ * Append data to the unrolled list ending at *tail (which may be NULL
+ * for an empty list), allocating a new node from the arena when the
+ * last one is full. Returns the new tail, or NULL if out of memory.
+ */
+struct s_unrolled_list *unrolled_append(struct arena *a,
+                                        struct s_unrolled_list *tail,
+                                        char *data)
 {
-	struct s_linked_list *list, *median;
-	int pos = 0, len, data_len;
+	struct s_unrolled_list *node = tail;
 
-	if (argc < 2 || !argv[1]) {
-		printf("%s list_size [data_len]\n", argv[0]);
-		printf("\tlist_size: Number of nodes to generate.\n");
-		printf("\tdata_len:  Length of the random data.\n");
-		exit(EXIT_FAILURE);
+	if (!node || node->count == UNROLL_K) {
+		if (!(node = arena_alloc(a, sizeof(struct s_unrolled_list)))) {
+			ERROR("unrolled_append: Out of memory!\n");
+			return NULL;
+		}
+
+		node->count = 0;
+		node->next  = NULL;
+		if (tail) tail->next = node;
+	}
+
+	node->data[node->count++] = data;
+	return node;
+}
+
+/**
+ * Build an unrolled list with the same data as list (which it shares.)
+ */
+struct s_unrolled_list *build_unrolled_list(struct arena *a,
+                                            struct s_linked_list *list)
+{
+	struct s_unrolled_list *head = NULL, *tail = NULL;
+
+	for (;list;list=list->next) {
+		if (!(tail = unrolled_append(a, tail, list->data))) return NULL;
+		if (!head) head = tail;
+	}
+
+	return head;
+}
+
+/**
+ * Find the median element of an unrolled list, at the same position as
+ * find_median() would. The first pass adds up the counts, and the second
+ * skips whole nodes until it reaches the one holding the median.
+ */
+char *unrolled_median(struct s_unrolled_list *list, int *pos)
+{
+	struct s_unrolled_list *x;
+	int n = 0, i;
+
+	for (x=list;x;x=x->next) n += x->count;
+	for (*pos=i=n/2,x=list;x && i>=x->count;x=x->next) i -= x->count;
+	return x ? x->data[i] : NULL;
+}
+
+/**
+ * A list which keeps track of its middle
+ *
+ * Nodes are pushed on at the tail and popped off the head, as in a queue,
+ * and since the middle only ever moves forward, a pointer to it can be
+ * kept up to date in O(1) time. The median is then just q->mid, at
+ * position q->len / 2.
+ */
+struct s_median_queue {
+	struct s_linked_list *head, *tail, *mid;
+	int len;
+};
+
+void mq_init(struct s_median_queue *q)
+{
+	q->head = q->tail = q->mid = NULL;
+	q->len  = 0;
+}
+
+/**
+ * Push a node on the tail. The middle moves on when the length becomes
+ * even.
+ */
+void mq_push(struct s_median_queue *q, struct s_linked_list *node)
+{
+	node->next = NULL;
+	if (!q->len++) {
+		q->head = q->tail = q->mid = node;
+		return;
+	}
+
+	q->tail->next = node;
+	q->tail = node;
+	if (!(q->len & 1)) q->mid = q->mid->next;
+}
+
+/**
+ * Pop the node off the head, or return NULL if the list is empty. Every
+ * position drops by 1, so the middle moves on when the length was odd.
+ */
+struct s_linked_list *mq_pop(struct s_median_queue *q)
+{
+	struct s_linked_list *node = q->head;
+
+	if (!node) return NULL;
+	q->head = node->next;
+	if (!--q->len) q->tail = q->mid = NULL;
+	else if (!(q->len & 1)) q->mid = q->mid->next;
+	return node;
+}
+
+/**
+ * Traversals that hide memory latency
+ *
+ * Following a list is a chain of dependent loads, so when the nodes are
+ * scattered in memory, each hop waits for a cache miss, and there's no
+ * way to fetch a node before the one pointing to it has arrived. What
+ * can overlap with the chain is the work hanging off each node (its
+ * data), and the chains of other lists.
+ */
+#if defined(__GNUC__)
+#define PREFETCH(X) __builtin_prefetch(X)
+#else
+#define PREFETCH(X) (void)(X)
+#endif
+
+/* Number of nodes the data is fetched ahead of its use */
+#define PREFETCH_DIST 16
+
+/* Maximum number of lists for find_median_batch() */
+#define MAX_BATCH 16
+
+/* Fold a node's data into a hash */
+#define HASH_NODE(H, X) ((H) * 31 + (unsigned char)(X)->data[0])
+
+/**
+ * A stand-in for a print_list() style traversal, which touches the data
+ * of each node: a hash of the first byte of each.
+ */
+unsigned long list_hash(struct s_linked_list *list)
+{
+	unsigned long h = 0;
+
+	for (;list;list=list->next) h = HASH_NODE(h, list);
+	return h;
+}
+
+/**
+ * The same hash, but with the data fetched PREFETCH_DIST nodes ahead of
+ * its use. The nodes in between wait in a ring, so that the data loads
+ * are in flight alongside the pointer chase, instead of after it.
+ */
+unsigned long list_hash_prefetch(struct s_linked_list *list)
+{
+	struct s_linked_list *ring[PREFETCH_DIST];
+	unsigned long h = 0;
+	int i = 0, n = 0;
+
+	for (;list;list=list->next) {
+		PREFETCH(list->data);
+		if (n == PREFETCH_DIST) h = HASH_NODE(h, ring[i]);
+		else n++;
+
+		ring[i] = list;
+		i = (i + 1) % PREFETCH_DIST;
+	}
+
+	/* Whatever is left in the ring, oldest first */
+	for (i=(n == PREFETCH_DIST) ? i : 0;n;n--,i=(i+1)%PREFETCH_DIST)
+		h = HASH_NODE(h, ring[i]);
+	return h;
+}
+
+/**
+ * Find the medians of count lists at once, as find_median() does for
+ * one. Each step moves every list's pointers along, so that the misses
+ * for up to MAX_BATCH lists are outstanding at the same time.
+ */
+void find_median_batch(struct s_linked_list **lists, int count,
+                       struct s_linked_list **medians, int *pos)
+{
+	struct s_linked_list *n1[MAX_BATCH], *n2[MAX_BATCH];
+	int i, j, k, active;
+
+	for (j=0;j<count;j+=MAX_BATCH) {
+		k = count - j < MAX_BATCH ? count - j : MAX_BATCH;
+		for (i=0;i<k;i++) {
+			n1[i] = n2[i] = lists[j + i];
+			pos[j + i] = 0;
+		}
+
+		do {
+			for (active=i=0;i<k;i++) {
+				if (!n1[i] || !n2[i] || !n2[i]->next) continue;
+				active = 1;
+				pos[j + i] += 1;
+				n1[i] = n1[i]->next;
+				n2[i] = n2[i]->next->next;
+			}
+		} while (active);
+
+		for (i=0;i<k;i++) medians[j + i] = n1[i];
+	}
+}
+
+/**
+ * A random number in [0, n), from two calls to rand(), since RAND_MAX
+ * may only be 32767.
+ */
+unsigned long rand_below(unsigned long n)
+{
+	return ((unsigned long)rand() * ((unsigned long)RAND_MAX + 1) +
+	        (unsigned long)rand()) % n;
+}
+
+/**
+ * Build a list as build_arena_list() does, but link the nodes in a
+ * random order, and give them their data in another random order, so
+ * that walking it misses the cache at (almost) every step, as a list
+ * built up over time by malloc() tends to.
+ */
+struct s_linked_list *build_shuffled_list(struct arena *a, int size,
+                                          int data_len)
+{
+	struct s_linked_list *block, **nodes, *tmp;
+	char *data, **order, *t;
+	unsigned long j;
+	int i;
+
+	if (size < 1) return NULL;
+	block = arena_alloc(a, size * sizeof(struct s_linked_list));
+	data  = arena_alloc(a, (size_t)size * (data_len + 1));
+	nodes = malloc(size * sizeof(struct s_linked_list *));
+	order = malloc(size * sizeof(char *));
+	if (!block || !data || !nodes || !order) {
+		ERROR("build_shuffled_list: Out of memory!\n");
+		free(nodes);
+		free(order);
+		return NULL;
+	}
+
+	for (i=0;i<size;i++) {
+		nodes[i] = block + i;
+		order[i] = data + (size_t)i * (data_len + 1);
+		random_fill(order[i], data_len);
+		order[i][data_len] = '\0';
+	}
+
+	/* Shuffle both, keeping the head at the front */
+	for (i=size-1;i>1;i--) {
+		j = 1 + rand_below((unsigned long)i);
+		tmp = nodes[i]; nodes[i] = nodes[j]; nodes[j] = tmp;
+		j = 1 + rand_below((unsigned long)i);
+		t = order[i]; order[i] = order[j]; order[j] = t;
+	}
+
+	for (i=0;i<size;i++) {
+		nodes[i]->data = order[i];
+		nodes[i]->next = i + 1 < size ? nodes[i + 1] : NULL;
+	}
+
+	memcpy(block->data, "HEAD", data_len < 4 ? data_len : 4);
+	free(nodes);
+	free(order);
+	return block;
+}
+
+/**
+ * Value medians
+ *
+ * find_median() finds the middle node. These find the middle value: the
+ * one which would be at position n / 2 if the values were sorted, as
+ * find_median() counts positions. They work on arrays of keys, and a
+ * node's key is the first few bytes of its data, so that keys sort as
+ * the strings would (up to the length of a long.)
+ *
+ * select_intro():   Quickselect, with a median-of-3 pivot, and falling
+ *                   back to a median-of-medians pivot if it's recursing
+ *                   too deep, so it can't go quadratic.
+ * select_floyd():   Floyd and Rivest's SELECT, which first narrows the
+ *                   range down to a small band around the k-th value,
+ *                   picked by recursing on a sample. This makes about
+ *                   n + k comparisons, versus 2-3n for quickselect.
+ * running median:   A max-heap of the lower half of the values and a
+ *                   min-heap of the upper half, for the median of a
+ *                   stream so far, with O(log n) pushes.
+ * window medians:   The median of each window of w values, from an
+ *                   indexable skiplist, in O(log w) per value.
+ */
+
+/* Ranges this short are insertion sorted, rather than partitioned */
+#define SELECT_SMALL 16
+
+/* Ranges longer than this are narrowed down first by select_floyd() */
+#define FLOYD_SAMPLE 600
+
+/* Maximum number of levels in a skiplist, each 4x sparser than the last */
+#define SKIP_LEVELS 16
+
+#define SWAP_KEYS(A, I, J) \
+	do { unsigned long t_ = (A)[I]; (A)[I] = (A)[J]; (A)[J] = t_; } while (0)
+
+/**
+ * The key for a string: its first sizeof(long) bytes, big-endian, so
+ * that comparing keys compares the strings (as far as they go.)
+ */
+unsigned long node_key(const char *s)
+{
+	unsigned long k = 0;
+	size_t i;
+
+	for (i=0;i<sizeof(unsigned long);i++) {
+		k = (k << 8) | (unsigned char)*s;
+		if (*s) s++;
+	}
+
+	return k;
+}
+
+/**
+ * Write the bytes of a key back into buf as a string.
+ */
+char *key_string(unsigned long k, char *buf)
+{
+	size_t i;
+
+	for (i=0;i<sizeof(unsigned long);i++)
+		buf[i] = (char)((k >> (8 * (sizeof(unsigned long) - 1 - i))) & 0xff);
+	buf[i] = '\0';
+	return buf;
+}
+
+void insertion_sort(unsigned long *a, size_t n)
+{
+	unsigned long v;
+	size_t i, j;
+
+	for (i=1;i<n;i++) {
+		for (v=a[i],j=i;j>0&&a[j-1]>v;j--) a[j] = a[j - 1];
+		a[j] = v;
+	}
+}
+
+unsigned long select_intro(unsigned long *a, size_t n, size_t k);
+
+/* For qsort(), to check the selection algorithms */
+int compare_keys(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * The median of the medians of each group of 5 of the n values, which
+ * is within the middle 40% or so of them. The medians are moved to the
+ * front of a.
+ */
+unsigned long median_of_medians(unsigned long *a, size_t n)
+{
+	size_t i, g;
+
+	for (g=i=0;i<n;i+=5,g++) {
+		insertion_sort(a + i, n - i < 5 ? n - i : 5);
+		SWAP_KEYS(a, g, i + (n - i < 5 ? (n - i) / 2 : 2));
+	}
+
+	return select_intro(a, g, g / 2);
+}
+
+/**
+ * Return the k-th smallest (from 0) of the n values in a, which are
+ * reordered, so that a[k] is that value, with no larger value before
+ * it, and no smaller value after it.
+ */
+unsigned long select_intro(unsigned long *a, size_t n, size_t k)
+{
+	unsigned long p, x, y, z;
+	size_t lo = 0, hi = n - 1, lt, gt, i;
+	int depth;
+
+	if (!n || k >= n) return 0;
+	for (depth=0,i=n;i>1;i>>=1) depth += 2;
+
+	while (hi > lo) {
+		if (hi - lo < SELECT_SMALL) {
+			insertion_sort(a + lo, hi - lo + 1);
+			break;
+		}
+
+		/* The median of the first, middle and last, or of medians */
+		if (depth-- > 0) {
+			x = a[lo]; y = a[lo + (hi - lo) / 2]; z = a[hi];
+			p = x < y ? (y < z ? y : x < z ? z : x) :
+			            (x < z ? x : y < z ? z : y);
+		} else p = median_of_medians(a + lo, hi - lo + 1);
+
+		/* Split into < p, == p and > p, so repeats don't hurt */
+		for (lt=i=lo,gt=hi;i<=gt;) {
+			if (a[i] < p) { SWAP_KEYS(a, lt, i); lt++; i++; }
+			else if (a[i] > p) {
+				SWAP_KEYS(a, i, gt);
+				gt--;
+			} else i++;
+		}
+
+		if (k < lt) hi = lt - 1;
+		else if (k > gt) lo = gt + 1;
+		else return p;
+	}
+
+	return a[k];
+}
+
+/**
+ * As select_intro(), but by Floyd and Rivest's method. (This follows
+ * their algorithm closely, and its indices are signed.)
+ */
+void floyd_rivest(unsigned long *a, long left, long right, long k)
+{
+	double n, i, z, s, sd;
+	unsigned long t;
+	long l, r;
+
+	while (right > left) {
+		if (right - left > FLOYD_SAMPLE) {
+			n  = (double)(right - left + 1);
+			i  = (double)(k - left + 1);
+			z  = log(n);
+			s  = 0.5 * exp(2.0 * z / 3.0);
+			sd = 0.5 * sqrt(z * s * (n - s) / n) * (i < n / 2 ? -1.0 : 1.0);
+			l  = (long)(k - i * s / n + sd);
+			r  = (long)(k + (n - i) * s / n + sd);
+			floyd_rivest(a, l > left ? l : left, r < right ? r : right, k);
+		}
+
+		t = a[k];
+		l = left;
+		r = right;
+		SWAP_KEYS(a, left, k);
+		if (a[right] > t) SWAP_KEYS(a, right, left);
+
+		while (l < r) {
+			SWAP_KEYS(a, l, r);
+			l++; r--;
+			while (a[l] < t) l++;
+			while (a[r] > t) r--;
+		}
+
+		if (a[left] == t) SWAP_KEYS(a, left, r);
+		else {
+			r++;
+			SWAP_KEYS(a, r, right);
+		}
+
+		if (r <= k) left = r + 1;
+		if (k <= r) right = r - 1;
 	}
+}
 
-	/* Seed the PRNG */
-	srand((unsigned int)time(NULL));
+unsigned long select_floyd(unsigned long *a, size_t n, size_t k)
+{
+	if (!n || k >= n) return 0;
+	floyd_rivest(a, 0, (long)n - 1, (long)k);
+	return a[k];
+}
+
+/**
+ * The median value of a list, by select_intro() over its keys. Returns
+ * 0 for an empty list, or if out of memory.
+ */
+unsigned long list_value_median(struct s_linked_list *list)
+{
+	struct s_linked_list *x;
+	unsigned long *keys, k;
+	size_t n;
+
+	for (n=0,x=list;x;x=x->next) n++;
+	if (!n || !(keys = malloc(n * sizeof(unsigned long)))) return 0;
+	for (n=0,x=list;x;x=x->next) keys[n++] = node_key(x->data);
+
+	k = select_intro(keys, n, n / 2);
+	free(keys);
+	return k;
+}
+
+/**
+ * A binary heap of keys, with the largest on top if max is set, and the
+ * smallest otherwise. It grows as needed.
+ */
+struct heap {
+	unsigned long *a;
+	size_t n, size;
+	int max;
+};
+
+#define HEAP_BEFORE(H, X, Y) ((H)->max ? (X) > (Y) : (X) < (Y))
+
+int heap_push(struct heap *h, unsigned long v)
+{
+	unsigned long *a;
+	size_t i, p;
+
+	if (h->n == h->size) {
+		if (!(a = realloc(h->a, (h->size * 2 + 16) * sizeof(unsigned long))))
+			return -1;
+		h->a    = a;
+		h->size = h->size * 2 + 16;
+	}
+
+	for (i=h->n++;i&&HEAP_BEFORE(h, v, h->a[p = (i - 1) / 2]);i=p)
+		h->a[i] = h->a[p];
+	h->a[i] = v;
+	return 0;
+}
+
+unsigned long heap_pop(struct heap *h)
+{
+	unsigned long top = h->a[0], v = h->a[--h->n];
+	size_t i = 0, c;
+
+	while ((c = 2 * i + 1) < h->n) {
+		if (c + 1 < h->n && HEAP_BEFORE(h, h->a[c + 1], h->a[c])) c++;
+		if (!HEAP_BEFORE(h, h->a[c], v)) break;
+		h->a[i] = h->a[c];
+		i = c;
+	}
+
+	h->a[i] = v;
+	return top;
+}
+
+/**
+ * The median of a stream: lo holds the smallest n / 2 values so far,
+ * and hi the rest, so the median is the top of hi.
+ */
+struct running_median {
+	struct heap lo, hi;
+};
+
+void rm_init(struct running_median *rm)
+{
+	memset(rm, 0, sizeof(struct running_median));
+	rm->lo.max = 1;
+}
+
+void rm_free(struct running_median *rm)
+{
+	free(rm->lo.a);
+	free(rm->hi.a);
+	rm_init(rm);
+}
+
+int rm_push(struct running_median *rm, unsigned long v)
+{
+	if (heap_push(rm->hi.n && v >= rm->hi.a[0] ? &rm->hi : &rm->lo, v))
+		return -1;
+
+	/* Rebalance, which moves at most one value */
+	if (rm->lo.n > rm->hi.n)
+		return heap_push(&rm->hi, heap_pop(&rm->lo));
+	if (rm->hi.n > rm->lo.n + 1)
+		return heap_push(&rm->lo, heap_pop(&rm->hi));
+	return 0;
+}
+
+unsigned long rm_median(const struct running_median *rm)
+{
+	return rm->hi.n ? rm->hi.a[0] : 0;
+}
+
+/**
+ * An indexable skiplist, after Hettinger's recipe: each link records
+ * how many positions it skips, so the i-th smallest value can be found
+ * by adding up widths on the way down, as a value is found by comparing
+ * on the way down.
+ *
+ * The nodes come from an arena, and removed nodes are kept on a free
+ * list for their level (they're different sizes) for reuse.
+ */
+struct skip_node;
+
+struct skip_link {
+	struct skip_node *next;
+	size_t width;
+};
+
+struct skip_node {
+	unsigned long value;
+	int levels;
+	struct skip_link link[1];
+};
+
+struct skiplist {
+	struct skip_node *head;
+	struct skip_node *free[SKIP_LEVELS];
+	struct arena *arena;
+	struct prng rng;
+	size_t size;
+	int levels;
+};
+
+struct skip_node *skip_node(struct skiplist *s, int levels)
+{
+	struct skip_node *node;
+
+	if ((node = s->free[levels - 1])) {
+		s->free[levels - 1] = node->link[0].next;
+		return node;
+	}
+
+	node = arena_alloc(s->arena, offsetof(struct skip_node, link) +
+	                             levels * sizeof(struct skip_link));
+	if (node) node->levels = levels;
+	return node;
+}
+
+/**
+ * Set up an empty skiplist, with enough levels for about max values.
+ */
+int skip_init(struct skiplist *s, struct arena *a, size_t max)
+{
+	int i;
+
+	memset(s, 0, sizeof(struct skiplist));
+	for (s->levels=1;s->levels<SKIP_LEVELS&&max>4;max/=4) s->levels++;
+	s->arena = a;
+	prng_seed(&s->rng, 0);
+	if (!(s->head = skip_node(s, s->levels))) return -1;
+
+	for (i=0;i<s->levels;i++) {
+		s->head->link[i].next  = NULL;
+		s->head->link[i].width = 1;
+	}
+
+	return 0;
+}
+
+/**
+ * A random number of levels: 1, then one more with a chance of 1 in 4,
+ * and so on.
+ */
+int skip_levels(struct skiplist *s)
+{
+	unsigned long x = prng_next(&s->rng);
+	int levels = 1;
+
+	for (;levels<s->levels&&!(x&3);x>>=2) levels++;
+	return levels;
+}
+
+int skip_insert(struct skiplist *s, unsigned long v)
+{
+	struct skip_node *chain[SKIP_LEVELS], *x = s->head, *node;
+	size_t steps[SKIP_LEVELS], n = 0, d;
+	int i, levels = skip_levels(s);
+
+	for (i=s->levels-1;i>=0;i--) {
+		for (;x->link[i].next&&x->link[i].next->value<=v;x=x->link[i].next)
+			n += x->link[i].width;
+		chain[i] = x;
+		steps[i] = n;
+	}
+
+	if (!(node = skip_node(s, levels))) return -1;
+	node->value = v;
+	for (i=0;i<levels;i++) {
+		d = n - steps[i];
+		node->link[i].next      = chain[i]->link[i].next;
+		node->link[i].width     = chain[i]->link[i].width - d;
+		chain[i]->link[i].next  = node;
+		chain[i]->link[i].width = d + 1;
+	}
+
+	for (;i<s->levels;i++) chain[i]->link[i].width++;
+	s->size++;
+	return 0;
+}
+
+/**
+ * Remove one copy of v, if there is one.
+ */
+void skip_remove(struct skiplist *s, unsigned long v)
+{
+	struct skip_node *chain[SKIP_LEVELS], *x = s->head, *node;
+	int i;
+
+	for (i=s->levels-1;i>=0;i--) {
+		for (;x->link[i].next&&x->link[i].next->value<v;x=x->link[i].next);
+		chain[i] = x;
+	}
+
+	node = x->link[0].next;
+	if (!node || node->value != v) return;
+
+	for (i=0;i<node->levels;i++) {
+		chain[i]->link[i].width += node->link[i].width - 1;
+		chain[i]->link[i].next   = node->link[i].next;
+	}
+
+	for (;i<s->levels;i++) chain[i]->link[i].width--;
+	node->link[0].next = s->free[node->levels - 1];
+	s->free[node->levels - 1] = node;
+	s->size--;
+}
+
+/**
+ * The i-th smallest value (from 0.)
+ */
+unsigned long skip_get(const struct skiplist *s, size_t i)
+{
+	const struct skip_node *x = s->head;
+	int l;
+
+	for (i++,l=s->levels-1;l>=0;l--) {
+		for (;x->link[l].next&&x->link[l].width<=i;x=x->link[l].next)
+			i -= x->link[l].width;
+	}
+
+	return x->value;
+}
+
+/**
+ * Store the median of each window of w of the n values in out (which
+ * has room for n - w + 1 of them.) Returns -1 if out of memory.
+ */
+int window_medians(const unsigned long *a, size_t n, size_t w,
+                   unsigned long *out)
+{
+	struct skiplist s;
+	struct arena ar;
+	size_t i;
+	int ret = 0;
+
+	if (!w || w > n) return 0;
+	arena_init(&ar);
+	if (skip_init(&s, &ar, w)) ret = -1;
+
+	for (i=0;!ret&&i<n;i++) {
+		if (i >= w) skip_remove(&s, a[i - w]);
+		if (skip_insert(&s, a[i])) ret = -1;
+		else if (i + 1 >= w) out[i + 1 - w] = skip_get(&s, w / 2);
+	}
+
+	arena_free(&ar);
+	return ret;
+}
+
+/**
+ * Parallel building
+ *
+ * Each thread builds a segment of the list, from its own arena and
+ * PRNG, and the segments are then spliced together, in order. The
+ * segments remember their heads, tails and lengths, so the median can be
+ * found by skipping to the right segment, and walking at most one
+ * segment's worth of nodes.
+ */
+struct s_segment {
+	struct s_linked_list *head, *tail;
+	struct arena arena;
+	struct prng prng;
+	int count;                /* Nodes in the segment */
+	int data_len;
+	int first;                /* Whether it starts with the HEAD node */
+};
+
+struct s_parallel_list {
+	struct s_linked_list *head;
+	struct s_segment seg[MAX_THREADS];
+	int segments;
+};
+
+/**
+ * Build one segment. If it runs out of memory, the count is cut down to
+ * the nodes built.
+ */
+void *build_segment(void *arg)
+{
+	struct s_segment *seg = arg;
+	struct s_linked_list *node;
+	int i;
+
+	seg->head = seg->tail = NULL;
+	for (i=0;i<seg->count;i++) {
+		node = arena_node(&seg->arena, !i && seg->first && seg->data_len < 4 ?
+		                               4 : seg->data_len);
+		if (!node) break;
+		if (!i && seg->first) memcpy(node->data, "HEAD", 4);
+		else prng_fill(&seg->prng, node->data, seg->data_len);
+
+		if (seg->tail) seg->tail->next = node;
+		else seg->head = node;
+		seg->tail = node;
+	}
+
+	seg->count = i;
+	return NULL;
+}
+
+/**
+ * Count the nodes in a segment again, as they may have changed since it
+ * was built.
+ */
+void *count_segment(void *arg)
+{
+	struct s_segment *seg = arg;
+	struct s_linked_list *x;
+	int n = 0;
+
+	for (x=seg->head;x;x=x==seg->tail?NULL:x->next) n++;
+	seg->count = n;
+	return NULL;
+}
+
+/**
+ * Run fn over each segment, with a thread for each.
+ */
+void for_each_segment(struct s_parallel_list *pl, void *(*fn)(void *))
+{
+	int t;
+	#ifdef USE_POSIX
+	pthread_t tids[MAX_THREADS];
+
+	for (t=1;t<pl->segments;t++) {
+		if (pthread_create(&tids[t], NULL, fn, &pl->seg[t]))
+			tids[t] = pthread_self();
+	}
+	#endif
+
+	if (pl->segments) fn(&pl->seg[0]);
+
+	#ifdef USE_POSIX
+	for (t=1;t<pl->segments;t++) {
+		if (pthread_equal(tids[t], pthread_self())) fn(&pl->seg[t]);
+		else pthread_join(tids[t], NULL);
+	}
+	#else
+	for (t=1;t<pl->segments;t++) fn(&pl->seg[t]);
+	#endif
+}
+
+void free_parallel_list(struct s_parallel_list *pl)
+{
+	int t;
+
+	for (t=0;t<pl->segments;t++) arena_free(&pl->seg[t].arena);
+	pl->head     = NULL;
+	pl->segments = 0;
+}
+
+/**
+ * Build a list of size nodes, as build_arena_list() does, with the given
+ * number of threads. Each thread's PRNG is seeded from seed and its
+ * number, so the list depends on both. Returns -1 if out of memory.
+ */
+int build_parallel_list(struct s_parallel_list *pl, int size, int data_len,
+                        int threads, unsigned long seed)
+{
+	struct s_linked_list *tail = NULL;
+	int t, chunk, built = 0;
+
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+	if (threads > size)        threads = size;
+	if (threads < 1)           threads = 1;
+
+	pl->head     = NULL;
+	pl->segments = size > 0 ? threads : 0;
+	chunk        = size / threads;
+
+	for (t=0;t<pl->segments;t++) {
+		arena_init(&pl->seg[t].arena);
+		prng_seed(&pl->seg[t].prng, seed + (unsigned long)t);
+		pl->seg[t].count    = t < threads - 1 ? chunk : size - t * chunk;
+		pl->seg[t].data_len = data_len;
+		pl->seg[t].first    = !t;
+	}
+
+	for_each_segment(pl, build_segment);
+
+	/* Splice the segments together */
+	for (t=0;t<pl->segments;t++) {
+		built += pl->seg[t].count;
+		if (!pl->seg[t].head) continue;
+
+		if (tail) tail->next = pl->seg[t].head;
+		else pl->head = pl->seg[t].head;
+		tail = pl->seg[t].tail;
+	}
+
+	if (built < size) {
+		ERROR("build_parallel_list: Out of memory!\n");
+		free_parallel_list(pl);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Find the node at position i from the segments' counts: skip to the
+ * segment it's in, then walk to it. Call for_each_segment(pl,
+ * count_segment) first if the segments may have changed.
+ */
+struct s_linked_list *parallel_nth(struct s_parallel_list *pl, int i)
+{
+	struct s_linked_list *x;
+	int t;
+
+	for (t=0;t<pl->segments&&i>=pl->seg[t].count;t++)
+		i -= pl->seg[t].count;
+	if (t == pl->segments || i < 0) return NULL;
+
+	for (x=pl->seg[t].head;i;i--) x = x->next;
+	return x;
+}
+
+/**
+ * Find the median node, at the same position as find_median() would.
+ */
+struct s_linked_list *parallel_median(struct s_parallel_list *pl, int *pos)
+{
+	int n = 0, t;
+
+	for (t=0;t<pl->segments;t++) n += pl->seg[t].count;
+	*pos = n / 2;
+	return parallel_nth(pl, n / 2);
+}
+
+double bench_now(void)
+{
+	#ifdef USE_POSIX
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+	#else
+	return (double)clock() / CLOCKS_PER_SEC;
+	#endif
+}
+
+/**
+ * The resident set size of the process, in bytes, or 0 if it isn't
+ * known.
+ */
+size_t rss_bytes(void)
+{
+	#ifdef USE_POSIX
+	unsigned long size, rss = 0;
+	FILE *f;
+
+	if ((f = fopen("/proc/self/statm", "r"))) {
+		if (fscanf(f, "%lu %lu", &size, &rss) != 2) rss = 0;
+		fclose(f);
+	}
+
+	return (size_t)rss * (size_t)sysconf(_SC_PAGESIZE);
+	#else
+	return 0;
+	#endif
+}
+
+/**
+ * Build, find the median of, and free a list of count nodes, with
+ * calloc() and with the arena, and compare the times and the memory the
+ * list takes. The arena goes first, since free() doesn't give the
+ * calloc()'d nodes back to the system.
+ */
+void benchmark(int count, int data_len)
+{
+	const char *names[] = { "arena", "calloc" };
+	struct s_linked_list *list, *median;
+	struct arena a;
+	double t[3];
+	size_t rss;
+	int i, pos = 0;
+
+	printf("%-10s %10s %13s %9s %8s %9s\n", "Allocator", "Build (s)",
+	       "Traverse (s)", "Free (s)", "ns/node", "RSS (MB)");
+	for (i=0;i<2;i++) {
+		srand(1);
+		arena_init(&a);
+		rss  = rss_bytes();
+		t[0] = bench_now();
+		list = i ? build_linked_list(count, data_len) :
+		           build_arena_list(&a, count, data_len);
+		t[1] = bench_now();
+		rss  = rss_bytes() - rss;
+		if (!list) exit(EXIT_FAILURE);
+
+		median = find_median(list, &pos);
+		t[2] = bench_now();
+		if (i) free_node(list);
+		else arena_free(&a);
+
+		printf("%-10s %10.6f %13.6f %9.6f %8.2f %9.2f%s\n", names[i],
+		       t[1] - t[0], t[2] - t[1], bench_now() - t[2],
+		       (t[1] - t[0]) * 1e9 / count, (double)rss / 1048576.0,
+		       median ? "" : " (no median)");
+	}
+
+	printf("The median node is at position %d\n", pos);
+}
+
+/**
+ * Compare find_median() with the median of an unrolled list, and with a
+ * tracked middle, for lists of 1K nodes (which fit in L1) up to max
+ * nodes, 4x bigger each time. Each query is repeated enough times to
+ * cover about 64M nodes.
+ *
+ * The tracked middle costs nothing to query, so its column is the time
+ * to keep it up to date, popping each node off the head and pushing it
+ * back on the tail (which leaves the list as it was, after n of them.)
+ */
+void benchmark_median(int max)
+{
+	struct s_linked_list *list, *median = NULL, *x, *next;
+	struct s_unrolled_list *unrolled;
+	struct s_median_queue q;
+	struct arena a;
+	double t[4];
+	char *data = NULL;
+	long i, reps;
+	int n, pos = 0, upos = 0;
+
+	printf("%10s %10s %12s %12s %8s %12s\n", "Nodes", "Size (KB)",
+	       "ns/node", "Unrolled", "Speedup", "Pop + push");
+	for (n=1024;n<=max;n*=4) {
+		srand(1);
+		arena_init(&a);
+		if (!(list = build_arena_list(&a, n, 4)) ||
+		    !(unrolled = build_unrolled_list(&a, list))) {
+			arena_free(&a);
+			break;
+		}
+
+		reps = n < (1 << 26) ? (1 << 26) / n : 1;
+		t[0] = bench_now();
+		for (i=0;i<reps;i++) median = find_median(list, &pos);
+		t[1] = bench_now();
+		for (i=0;i<reps;i++) data = unrolled_median(unrolled, &upos);
+		t[2] = bench_now();
+
+		/* Move the nodes over to a queue, in the same order */
+		mq_init(&q);
+		for (x=list;x;x=next) {
+			next = x->next;
+			mq_push(&q, x);
+		}
+
+		t[3] = bench_now();
+		for (i=0;i<reps*n;i++) mq_push(&q, mq_pop(&q));
+		t[3] = bench_now() - t[3];
+
+		printf("%10d %10.0f %12.3f %12.3f %8.2f %12.3f%s\n", n,
+		       (double)a.used / 1024.0, (t[1] - t[0]) * 1e9 / reps / n,
+		       (t[2] - t[1]) * 1e9 / reps / n,
+		       t[2] > t[1] ? (t[1] - t[0]) / (t[2] - t[1]) : 0.0,
+		       t[3] * 1e9 / reps / n,
+		       (pos != upos || median->data != data || q.mid != median) ?
+		       " (MISMATCH)" : "");
+		arena_free(&a);
+		if (n > max / 4) break;
+	}
+}
+
+/**
+ * Time find_median() and the hash traversals over a list of size nodes
+ * laid out in order, and one with its nodes shuffled, then find the
+ * medians of batch shuffled lists (of size / batch nodes each) one by
+ * one, and all at once.
+ */
+void benchmark_prefetch(int size, int batch)
+{
+	const char *names[] = { "find_median", "hash", "hash/prefetch" };
+	struct s_linked_list *list, *lists[MAX_BATCH];
+	struct s_linked_list *ref[MAX_BATCH], *medians[MAX_BATCH];
+	struct arena a;
+	unsigned long h[3];
+	double t[3];
+	int i, j, pos[MAX_BATCH], bpos[MAX_BATCH], ok;
+
+	arena_init(&a);
+	printf("%-16s %-14s %10s %8s\n", "List", "Traversal", "ns/node",
+	       "Speedup");
+	for (i=0;i<2;i++) {
+		srand(1);
+		list = i ? build_shuffled_list(&a, size, 8) :
+		           build_arena_list(&a, size, 8);
+		if (!list) exit(EXIT_FAILURE);
+
+		for (j=0;j<3;j++) {
+			t[j] = bench_now();
+			switch (j) {
+				case 0: find_median(list, pos); break;
+				case 1: h[1] = list_hash(list); break;
+				case 2: h[2] = list_hash_prefetch(list); break;
+			}
+			t[j] = bench_now() - t[j];
+
+			printf("%-16s %-14s %10.3f %8.2f%s\n",
+			       i ? "shuffled" : "in order", names[j], t[j] * 1e9 / size,
+			       j == 2 && t[2] > 0 ? t[1] / t[2] : 1.0,
+			       j == 2 && h[1] != h[2] ? " (MISMATCH)" : "");
+		}
+	}
+
+	/* The batch, one at a time, then all at once */
+	size = size / batch * batch;
+	for (i=0;i<batch;i++) {
+		if (!(lists[i] = build_shuffled_list(&a, size / batch, 8)))
+			exit(EXIT_FAILURE);
+	}
+
+	t[0] = bench_now();
+	for (i=0;i<batch;i++) ref[i] = find_median(lists[i], pos + i);
+	t[1] = bench_now();
+	find_median_batch(lists, batch, medians, bpos);
+	t[2] = bench_now();
+
+	for (ok=1,i=0;i<batch;i++)
+		ok = ok && ref[i] == medians[i] && pos[i] == bpos[i];
+
+	printf("%2d x shuffled    %-14s %10.3f %8.2f\n", batch, "find_median",
+	       (t[1] - t[0]) * 1e9 / size, 1.0);
+	printf("%2d x shuffled    %-14s %10.3f %8.2f%s\n", batch, "batched",
+	       (t[2] - t[1]) * 1e9 / size,
+	       t[2] > t[1] ? (t[1] - t[0]) / (t[2] - t[1]) : 1.0,
+	       ok ? "" : " (MISMATCH)");
+	arena_free(&a);
+}
+
+/**
+ * Find the median of count random keys, for count from 1M up to max,
+ * 10x bigger each time: by sorting (up to 10M, as it's slow), by each
+ * selection algorithm, as a running median (pushing each key), and the
+ * median of each window of w keys.
+ */
+void benchmark_values(long max, long w)
+{
+	const char *names[] = { "qsort", "introselect", "floyd-rivest",
+	                        "two heaps", "window" };
+	struct running_median rm;
+	unsigned long *a, *b, x = 1, m = 0;
+	double t;
+	size_t n, i;
+	int j, bad;
+
+	printf("%10s %-14s %10s %10s %12s\n", "Count", "Method", "Time (s)",
+	       "ns/value", "Median");
+	for (n=1000000;n<=(size_t)max;n*=10) {
+		a = malloc(n * sizeof(unsigned long));
+		b = malloc(n * sizeof(unsigned long));
+		if (!a || !b) {
+			ERROR("benchmark_values: Out of memory!\n");
+			free(a);
+			break;
+		}
+
+		/* Keys from a 32-bit LCG, which is plenty for this */
+		for (i=0;i<n;i++) a[i] = x = (x * 69069 + 1) & 0xffffffffUL;
+
+		for (j=0;j<5;j++) {
+			if (!j && n > 10000000) continue;
+			if (j < 3) memcpy(b, a, n * sizeof(unsigned long));
+
+			t = bench_now();
+			bad = 0;
+			switch (j) {
+				case 0:
+					qsort(b, n, sizeof(unsigned long), compare_keys);
+					m = b[n / 2];
+					break;
+				case 1: m = select_intro(b, n, n / 2); break;
+				case 2: bad = select_floyd(b, n, n / 2) != m; break;
+				case 3:
+					rm_init(&rm);
+					for (i=0;i<n&&!bad;i++) bad = rm_push(&rm, a[i]);
+
+					bad = bad || rm_median(&rm) != m;
+					rm_free(&rm);
+					break;
+				case 4:
+					if ((size_t)w > n) w = (long)n;
+					bad = window_medians(a, n, (size_t)w, b);
+					m   = b[n - w];
+					break;
+			}
+			t = bench_now() - t;
+
+			/* Check the last window */
+			if (j == 4 && !bad) {
+				memcpy(b, a + n - w, w * sizeof(unsigned long));
+				bad = select_intro(b, (size_t)w, (size_t)w / 2) != m;
+			}
+
+			printf("%10lu %-14s %10.6f %10.3f %12lu%s\n", (unsigned long)n,
+			       names[j], t, t * 1e9 / n, m,
+			       bad ? " (MISMATCH)" : "");
+		}
+
+		free(b);
+		free(a);
+		if (n > (size_t)max / 10) break;
+	}
+}
+
+/**
+ * Build a list of size nodes with 1 thread, then 2, 4, ... up to the
+ * given number, and time building it, counting the segments again, and
+ * seeking to a node from the counts, checking it (and the median)
+ * against walking the whole list.
+ *
+ * The node sought is halfway into the segment holding the median, so
+ * each seek walks half a segment. (The median itself would be the head
+ * of a segment, with an even number of equal segments.)
+ */
+void benchmark_parallel(int size, int threads)
+{
+	struct s_parallel_list pl;
+	struct s_linked_list *x, *y;
+	double t[4], t1[2] = { 0, 0 };
+	int th, i, k, pos = 0, ppos = 0;
+
+	printf("%7s %10s %8s %8s %10s %8s %10s\n", "Threads", "Build (s)",
+	       "Speedup", "ns/node", "Count (s)", "Speedup", "Seek (ms)");
+	for (th=1;th<=threads;th=(th*2>threads && th<threads) ? threads : th*2) {
+		t[0] = bench_now();
+		if (build_parallel_list(&pl, size, 8, th, 1)) break;
+		t[1] = bench_now();
+		for_each_segment(&pl, count_segment);
+		t[2] = bench_now();
+		k = size / pl.segments * (pl.segments / 2) + size / pl.segments / 2;
+		x = parallel_nth(&pl, k);
+		t[3] = bench_now();
+
+		if (th == 1) {
+			t1[0] = t[1] - t[0];
+			t1[1] = t[2] - t[1];
+		}
+
+		/* Check both against walking the list itself */
+		for (y=pl.head,i=0;y&&i<k;i++) y = y->next;
+		printf("%7d %10.6f %8.2f %8.2f %10.6f %8.2f %10.3f%s\n", th,
+		       t[1] - t[0], t[1] > t[0] ? t1[0] / (t[1] - t[0]) : 0.0,
+		       (t[1] - t[0]) * 1e9 / size, t[2] - t[1],
+		       t[2] > t[1] ? t1[1] / (t[2] - t[1]) : 0.0, (t[3] - t[2]) * 1e3,
+		       parallel_median(&pl, &ppos) != find_median(pl.head, &pos) ||
+		       pos != ppos || x != y ? " (MISMATCH)" : "");
+		free_parallel_list(&pl);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct s_linked_list *list, *median;
+	struct s_parallel_list pl;
+	char buf[sizeof(unsigned long) + 1];
+	int pos = 0, len, data_len, threads;
+
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		len = argc > 2 ? atoi(argv[2]) : BENCH_COUNT;
+		benchmark(len < 1 ? 1 : len, argc > 3 ? atoi(argv[3]) : 8);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-bp")) {
+		len = argc > 2 ? atoi(argv[2]) : 1 << 22;
+		pos = argc > 3 ? atoi(argv[3]) : 8;
+		pos = pos < 1 ? 1 : pos > MAX_BATCH ? MAX_BATCH : pos;
+		benchmark_prefetch(len < pos ? pos : len, pos);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-bv")) {
+		benchmark_values(argc > 2 ? atol(argv[2]) : 10000000L,
+		                 argc > 3 && atol(argv[3]) > 0 ? atol(argv[3]) : 1001);
+		return 0;
+	}
+
+	#ifdef USE_POSIX
+	if (argc > 1 && !strcmp(argv[1], "-bt")) {
+		threads = argc > 3 ? atoi(argv[3]) :
+		          (int)sysconf(_SC_NPROCESSORS_ONLN);
+	#else
+	if (argc > 1 && !strcmp(argv[1], "-bt")) {
+		threads = argc > 3 ? atoi(argv[3]) : 1;
+	#endif
+		len = argc > 2 ? atoi(argv[2]) : BENCH_COUNT;
+		threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS :
+		          threads;
+		benchmark_parallel(len < threads ? threads : len, threads);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-bm")) {
+		benchmark_median(argc > 2 ? atoi(argv[2]) : 1 << 24);
+		return 0;
+	}
+
+	if (argc < 2 || !argv[1] || (argc > 2 && atoi(argv[2]) < 0)) {
+		printf("%s list_size [data_len [threads]]\n", argv[0]);
+		printf("%s -b [list_size [data_len]]\n", argv[0]);
+		printf("%s -bm [max_size]\n", argv[0]);
+		printf("%s -bp [list_size [batch]]\n", argv[0]);
+		printf("%s -bv [max_count [window]]\n", argv[0]);
+		printf("%s -bt [list_size [threads]]\n", argv[0]);
+		printf("\tlist_size: Number of nodes to generate.\n");
+		printf("\tdata_len:  Length of the random data.\n");
+		printf("\tthreads:   Number of threads to build the list with.\n");
+		printf("\t-b:        Benchmark the allocators.\n");
+		printf("\t-bm:       Benchmark the median of lists up to max_size "
+		       "nodes.\n");
+		printf("\t-bp:       Benchmark the prefetching traversals, and "
+		       "batch\n\t           medians of up to %d lists.\n", MAX_BATCH);
+		printf("\t-bv:       Benchmark the value medians over 1M up to "
+		       "max_count\n\t           values.\n");
+		printf("\t-bt:       Benchmark building with 1 up to threads "
+		       "threads.\n");
+		exit(EXIT_FAILURE);
+	}
 
-	/* Build the list */
+	/* Build the list, seeding the PRNGs from the time */
 	len = atoi(argv[1]);
-	data_len = argv[2] ? atoi(argv[2]) : 8;
-	if (!(list = build_linked_list(len, data_len)))
+	data_len = argc > 2 ? atoi(argv[2]) : 8;
+	threads = argc > 3 ? atoi(argv[3]) : 1;
+	if (build_parallel_list(&pl, len < 1 ? 1 : len, data_len, threads,
+	                        (unsigned long)time(NULL)) || !(list = pl.head))
 		exit(EXIT_FAILURE);
 
 	/* Find the median */
 	median = find_median(list, &pos);
 	printf("The median node is at position %d\n", pos);
+	printf("The median value is %s\n",
+	       key_string(list_value_median(list), buf));
 
 	/* Graph the list, if we have a small number of nodes */
 	if (len <= 8) print_list(list, median);
 
 	/* Cleanup */
-	free_node(list);
+	free_parallel_list(&pl);
 	return 0;
 }
@@ -6,6 +6,8 @@
  * See the LICENSE file for details.
  *
  * Compiling: gcc -ansi -pedantic -Wall -W -O2 -o phone phone.c
+ * Defines:
+ *     USE_POSIX: Enable the multi-threaded enumerator (link with -lpthread.)
  *
  * Running:
  *     tim@cid ~ $ ./phone 8675309
@@ -13,12 +15,24 @@
  *     ...
  *     #729: VORLF0Y
  *     Done!
+ *     tim@cid ~ $ ./phone 8675309 0 --range 100:102 --threads 2
+ *     #101: TNPLD0X
+ *     #102: TNPLD0Y
+ *     Done!
  */
+#ifdef USE_POSIX
+#define _XOPEN_SOURCE 600
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
+#ifdef USE_POSIX
+#include <pthread.h>
+#endif
+
 /* Quick error macros */
 #define ERROR(X)      fprintf(stderr, (X))
 #define ERROR_1(X, Y) fprintf(stderr, (X), (Y))
@@ -26,6 +40,16 @@
 /* Location of the overflow bit in the counter */
 #define OVERFLOW (1 << 14)
 
+/**
+ * Maximum length of a number for the rank-based functions. 4^15
+ * combinations still fit in a 32-bit unsigned long.
+ */
+#define RANK_MAX_DIGITS 15
+
+/* Maximum number of worker threads, and lines per thread per batch */
+#define MAX_THREADS 64
+#define BATCH_LINES 4096
+
 /**
  * Our state structure
  *
@@ -164,6 +188,374 @@ int permute_num(struct phone_state *state,
 	return 0;
 }
 
+/**
+ * Number of letters that a digit can represent.
+ */
+int digit_radix(char digit, int qz)
+{
+	if (digit == '0' || digit == '1') return 1;
+	if (digit == '7' || digit == '9') return qz ? 4 : 3;
+	return 3;
+}
+
+/**
+ * Letter represented by the given digit and counter value.
+ */
+char digit_letter(char digit, int value, int qz)
+{
+	if (digit == '0' || digit == '1') return digit;
+	if (!qz && digit == '7' && value) value++; /* Skip 'Q' */
+	return (char)('A' + digit_to_alpha[digit - '2'] + value);
+}
+
+/**
+ * Counter value of the given letter for a digit, or -1 if the
+ * digit can't represent that letter.
+ */
+int letter_value(char digit, char letter, int qz)
+{
+	int value;
+
+	if (digit == '0' || digit == '1')
+		return (letter == digit) ? 0 : -1;
+
+	value = letter - 'A' - digit_to_alpha[digit - '2'];
+	if (!qz && digit == '7' && value) value--; /* Skip 'Q' */
+	if (value < 0 || value >= digit_radix(digit, qz) ||
+	    digit_letter(digit, value, qz) != letter)
+		return -1;
+	return value;
+}
+
+/**
+ * Count the combinations of letters for a number.
+ *
+ * The combinations form a mixed-radix number, where each position's
+ * radix is the number of letters for that digit. The count is simply
+ * the product of the radices.
+ *
+ * Returns:
+ *     0 if the number is invalid or longer than RANK_MAX_DIGITS
+ *     the number of combinations otherwise
+ */
+unsigned long combination_count(const char *number, int num_len, int qz)
+{
+	unsigned long count = 1; int i;
+
+	if (!number || num_len < 1 || num_len > RANK_MAX_DIGITS)
+		return 0;
+
+	for (i=0;i<num_len;i++) {
+		if (number[i] < '0' || number[i] > '9') return 0;
+		count *= (unsigned long)digit_radix(number[i], qz);
+	}
+
+	return count;
+}
+
+/**
+ * Compute combination number 'rank' (counting from 0) directly.
+ *
+ * Rather than stepping through the sequence, we just convert the rank
+ * to our mixed-radix representation, right-most position first. This
+ * runs in O(n) time, for any rank, in the same order as permute_num().
+ *
+ * combo must have room for num_len + 1 characters.
+ *
+ * Returns:
+ *     -EINVAL if invalid arguments are passed to this function
+ *     0       otherwise
+ */
+int unrank_combination(const char *number, int num_len, int qz,
+                       unsigned long rank, char *combo)
+{
+	int i, radix;
+
+	if (!combo || rank >= combination_count(number, num_len, qz))
+		return -EINVAL;
+
+	for (i=num_len-1;i>=0;i--) {
+		radix    = digit_radix(number[i], qz);
+		combo[i] = digit_letter(number[i], (int)(rank % radix), qz);
+		rank    /= radix;
+	}
+
+	combo[num_len] = '\0';
+	return 0;
+}
+
+/**
+ * The reverse of unrank_combination(): compute the rank of a
+ * given combination.
+ *
+ * Returns:
+ *     -EINVAL if the combination doesn't match the number
+ *     0       otherwise, with the rank stored in *rank
+ */
+int rank_combination(const char *number, int num_len, int qz,
+                     const char *combo, unsigned long *rank)
+{
+	int i, value;
+
+	if (!combo || !rank || !combination_count(number, num_len, qz))
+		return -EINVAL;
+
+	for (*rank=0,i=0;i<num_len;i++) {
+		if ((value = letter_value(number[i], combo[i], qz)) < 0)
+			return -EINVAL;
+		*rank = *rank * digit_radix(number[i], qz) + value;
+	}
+
+	return combo[num_len] ? -EINVAL : 0;
+}
+
+/**
+ * Advance a combination to the next one in sequence.
+ *
+ * Returns:
+ *     0 if the combination wrapped around to the first one
+ *     1 otherwise
+ */
+int next_combination(const char *number, int num_len, int qz, char *combo)
+{
+	int i, value;
+
+	for (i=num_len-1;i>=0;i--) {
+		if (number[i] == '0' || number[i] == '1') continue;
+		value = letter_value(number[i], combo[i], qz) + 1;
+
+		if (value < digit_radix(number[i], qz)) {
+			combo[i] = digit_letter(number[i], value, qz);
+			return 1;
+		}
+
+		combo[i] = digit_letter(number[i], 0, qz);
+	}
+
+	return 0;
+}
+
+/* Pairs of decimal digits, "00" through "99" */
+const char digit_pairs[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/**
+ * Write the decimal digits of v into buf, two at a time, and return
+ * how many were written. No NUL is appended. render_job() uses this
+ * for the rank of each line, which it builds straight into its batch.
+ */
+size_t format_ulong(char *buf, unsigned long v)
+{
+	char tmp[24], *p = tmp + sizeof(tmp);
+	unsigned long i;
+
+	while (v >= 100) {
+		i  = (v % 100) * 2;
+		v /= 100;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	}
+
+	if (v >= 10) {
+		*--p = digit_pairs[v * 2 + 1];
+		*--p = digit_pairs[v * 2];
+	} else *--p = (char)('0' + v);
+
+	memcpy(buf, p, (size_t)(tmp + sizeof(tmp) - p));
+	return (size_t)(tmp + sizeof(tmp) - p);
+}
+
+/**
+ * A slice of the rank space, rendered into its own buffer.
+ */
+struct phone_job {
+	const char    *number;
+	int            num_len;
+	int            qz;
+	unsigned long  start;
+	unsigned long  end;
+	char          *buf;
+	size_t         len;
+};
+
+/**
+ * Render every combination in [start, end) into the job's buffer.
+ */
+void *render_job(void *arg)
+{
+	struct phone_job *job = arg;
+	char combo[RANK_MAX_DIGITS + 1], *p;
+	unsigned long rank;
+
+	job->len = 0;
+	if (job->start >= job->end ||
+	    unrank_combination(job->number, job->num_len, job->qz,
+	                       job->start, combo))
+		return NULL;
+
+	for (rank=job->start;rank<job->end;rank++) {
+		p    = job->buf + job->len;
+		*p++ = '#';
+		p   += format_ulong(p, rank + 1);
+		*p++ = ':';
+		*p++ = ' ';
+		memcpy(p, combo, (size_t)job->num_len);
+		p   += job->num_len;
+		*p++ = '\n';
+		job->len = (size_t)(p - job->buf);
+		next_combination(job->number, job->num_len, job->qz, combo);
+	}
+
+	return NULL;
+}
+
+/**
+ * Parse one side of a --range argument: a decimal number, ending at
+ * the ':' or the end of the string.
+ *
+ * Returns:
+ *     -EINVAL if the number is malformed or out of range
+ *     0       otherwise
+ */
+int parse_rank(const char *s, char **end, unsigned long *v)
+{
+	if (*s < '0' || *s > '9') return -EINVAL;
+
+	errno = 0;
+	*v    = strtoul(s, end, 10);
+	if (errno || (**end && **end != ':')) return -EINVAL;
+	return 0;
+}
+
+/**
+ * Parse a --range argument of the form start:end, where either side
+ * may be omitted. has_end is cleared if end was omitted, so that an
+ * explicit end of 0 can be told apart from a missing one.
+ *
+ * Returns:
+ *     -EINVAL if the range is malformed, or start > end
+ *     0       otherwise
+ */
+int parse_range(const char *arg, unsigned long *start,
+                unsigned long *end, int *has_end)
+{
+	char *p = (char *)arg;
+
+	*start   = 0;
+	*has_end = 0;
+	if (*p != ':' && parse_rank(p, &p, start)) return -EINVAL;
+	if (*p++ != ':') return -EINVAL;
+	if (*p) {
+		if (parse_rank(p, &p, end) || *p) return -EINVAL;
+		if (*start > *end) return -EINVAL;
+		*has_end = 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Print the usage message, and exit with an error.
+ */
+void usage(const char *arg0)
+{
+	printf("%s phone_number [enable_qz] [--range start:end] "
+	       "[--threads n]\n", arg0);
+	printf("\tphone_number: Phone number (e.g. 8675309)\n");
+	printf("\tenable_qz:    1: Enable use of 'Q' and 'Z'\n");
+	printf("\t              0: Disable (default)\n");
+	printf("\t--range:      Only print combinations start to end-1\n");
+	printf("\t--threads:    Number of threads to use\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Print the combinations in [start, end), splitting the work
+ * across the given number of threads.
+ *
+ * The range is processed in batches, so that memory use is bounded
+ * regardless of the range. Each batch is split into contiguous slices
+ * of the rank space, and each thread renders its slice into its own
+ * buffer, starting at its slice's first rank via unrank_combination().
+ * The buffers are then written out in order, so the output is the
+ * same for any number of threads.
+ *
+ * Without USE_POSIX, the slices are simply rendered one after another.
+ *
+ * Returns:
+ *     -EINVAL if invalid arguments are passed to this function
+ *     -ENOMEM if the buffers couldn't be allocated
+ *     0       otherwise
+ */
+int enumerate_range(const char *number, int num_len, int qz,
+                    unsigned long start, unsigned long end, int threads)
+{
+	struct phone_job jobs[MAX_THREADS];
+	unsigned long count, per;
+	int i;
+	#ifdef USE_POSIX
+	pthread_t tids[MAX_THREADS];
+	#endif
+
+	count = combination_count(number, num_len, qz);
+	if (!count || start > end || end > count)
+		return -EINVAL;
+
+	if (threads < 1)           threads = 1;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+	/* Each line is "#<rank>: <combo>\n" */
+	for (i=0;i<threads;i++) {
+		jobs[i].number  = number;
+		jobs[i].num_len = num_len;
+		jobs[i].qz      = qz;
+		if (!(jobs[i].buf = malloc((size_t)BATCH_LINES *
+		                           (size_t)(num_len + 16)))) {
+			while (i--) free(jobs[i].buf);
+			return -ENOMEM;
+		}
+	}
+
+	while (start < end) {
+		/* Split up the batch */
+		per = (end - start + threads - 1) / threads;
+		if (per > BATCH_LINES) per = BATCH_LINES;
+
+		for (i=0;i<threads;i++) {
+			jobs[i].start = start;
+			jobs[i].end   = (end - start > per) ? start + per : end;
+			start         = jobs[i].end;
+		}
+
+		#ifdef USE_POSIX
+		for (i=1;i<threads;i++) {
+			if (pthread_create(&tids[i], NULL, render_job, &jobs[i]))
+				tids[i] = pthread_self();
+		}
+
+		render_job(&jobs[0]);
+		for (i=1;i<threads;i++) {
+			if (pthread_equal(tids[i], pthread_self()))
+				render_job(&jobs[i]);
+			else pthread_join(tids[i], NULL);
+		}
+		#else
+		for (i=0;i<threads;i++) render_job(&jobs[i]);
+		#endif
+
+		/* Concatenate the output in order */
+		for (i=0;i<threads;i++)
+			fwrite(jobs[i].buf, 1, jobs[i].len, stdout);
+	}
+
+	for (i=0;i<threads;i++) free(jobs[i].buf);
+	return 0;
+}
+
 /**
  * Note: The maximum possible permutations will be in the range:
  * 1 .. 3^7 (2187) or 4^7 (16384).
@@ -173,25 +565,53 @@ int permute_num(struct phone_state *state,
  *     7's and 9's only: 3^7 permutations, or
  *                       4^7 permutations (if enable_qz is set.)
  *     no 0's or 1's:    3^7 permutations (if enable_qz is not set.)
+ *
+ * With --range or --threads, the rank-based enumerator is used instead,
+ * which handles numbers of up to RANK_MAX_DIGITS digits. A range is
+ * given as start:end (counting from 0, end exclusive), and either side
+ * may be omitted. This allows the sequence to be sharded across several
+ * processes, e.g. 0:8192 and 8192: .
  */
 int main(int argc, char *argv[])
 {
-	int qz=0, num_len, i;
+	int qz=0, num_len, i, ranged = 0, has_end = 0, threads = 1;
+	unsigned long start = 0, end = 0;
 	struct phone_state *state;
 
 	/* Handle arguments */
-	if (argc < 2 || !argv[1]) {
-		printf("%s phone_number [enable_qz]\n",argv[0]);
-		printf("\tphone_number: Phone number (e.g. 8675309)\n");
-		printf("\tenable_qz:    1: Enable use of 'Q' and 'Z'\n");
-		printf("\t              0: Disable (default)\n");
-		exit(EXIT_FAILURE);
-	} else if (argc == 3) {
-		qz = (argv[2] && atoi(argv[2]) == 1) ? 1 : 0;
+	if (argc < 2 || !argv[1]) usage(argv[0]);
+
+	for (i=2;i<argc;i++) {
+		if (!strcmp(argv[i], "--range") && i + 1 < argc) {
+			if (parse_range(argv[++i], &start, &end, &has_end))
+				usage(argv[0]);
+			ranged = 1;
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+			ranged  = 1;
+		} else qz = (atoi(argv[i]) == 1) ? 1 : 0;
 	}
 
 	/* Get the length of the number */
 	num_len = strlen(argv[1]);
+	if (ranged) {
+		if (!combination_count(argv[1], num_len, qz)) {
+			ERROR_1("The number must be 1 to %d digits.\n",
+			        RANK_MAX_DIGITS);
+			exit(EXIT_FAILURE);
+		}
+
+		if (!has_end) end = combination_count(argv[1], num_len, qz);
+		if ((i = enumerate_range(argv[1], num_len, qz,
+		                         start, end, threads)) < 0) {
+			ERROR_1("%s\n", strerror(-1 * i));
+			exit(EXIT_FAILURE);
+		}
+
+		printf("Done!\n");
+		return 0;
+	}
+
 	if (num_len > 7) {
 		ERROR("The number can't be longer than 7 digits.\n");
 		exit(EXIT_FAILURE);
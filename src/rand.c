@@ -5,15 +5,80 @@
  * This code is licenced under the Simplified BSD License.
  * See the LICENSE file for details.
  *
- * Compiling: gcc -ansi -pedantic -Wall -W -O2 -o rand rand.c
+ * Compiling: gcc -ansi -pedantic -Wall -W -O2 -o rand rand.c -lm
+ * Defines:
+ *     USE_C:     Don't use the AVX2 bulk fill kernel.
+ *     USE_POSIX: Enable the multi-threaded fills, and use clock_gettime()
+ *                for the benchmark timer. Link with -lpthread.
+ *
  * Running:
  *     tim@cid ~ $ ./rand 0 32 6
  *     Generated: 15,6,4,27,12,22
+ *     tim@cid ~ $ ./rand -g lcg 0 32 6
+ *     Generated: 9,28,3,14,0,21
+ *     tim@cid ~ $ ./rand -b
+ *     Generator    Time (s)   ns/number   numbers/ns
+ *     ...
  */
+#ifdef USE_POSIX
+#define _XOPEN_SOURCE 600
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <math.h>
 #include <time.h>
 
+#ifdef USE_POSIX
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+/* Number of numbers to generate for the benchmark */
+#define BENCH_COUNT 100000000L
+
+/**
+ * The smallest slice of a parallel fill, the numbers generated at a time
+ * for the sequence, and the size of the output buffer (smaller with a
+ * 16-bit int, where no object may be 64K)
+ */
+#define FILL_BLOCK 4096
+#if UINT_MAX <= 0xffffU
+#define SEQ_BLOCK  0x400L
+#define OUT_BUF    0x1000
+#else
+#define SEQ_BLOCK  0x40000L
+#define OUT_BUF    0x10000
+#endif
+
+/* Numbers per fill for the fill benchmark */
+#define FILL_BENCH 0x10000
+
+/* Maximum number of threads for rng_fill_parallel() */
+#define MAX_THREADS 64
+
+/**
+ * The 64-bit generators below need a 64-bit unsigned long. Elsewhere,
+ * only my_rand() is available.
+ */
+#if ULONG_MAX > 0xffffffffUL
+#define HAVE_RNG64
+#endif
+
+#if defined(HAVE_RNG64) && defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 uint128;
+#endif
+
+/* The AVX2 fill kernel is picked at runtime, if the CPU supports it */
+#if defined(HAVE_RNG64) && !defined(USE_C) && defined(__x86_64__) && \
+    (defined(__clang__) || __GNUC__ >= 5)
+#define USE_SIMD
+#include <immintrin.h>
+#endif
+
 /**
  * Generate a pseudo-random number
  *
@@ -29,7 +94,9 @@
  * the bounds are applied.
  *
  * This isn't particularly 'random', but for demonstration purposes
- * it's enough.
+ * it's enough. Only 8 bits of the state are used, and the modulus is
+ * biased, so the generators below should be preferred. This one is kept
+ * for comparison (rand -g lcg.)
  */
 unsigned int my_rand(unsigned long *seed,
                      unsigned int lbound,
@@ -40,30 +107,2220 @@ unsigned int my_rand(unsigned long *seed,
 	return (unsigned int)(lbound + ((*seed & 0x0ff0) >> 4) % ubound);
 }
 
-int main(int argc, char *argv[])
+#ifdef HAVE_RNG64
+/**
+ * 64-bit generators
+ *
+ * Each generator keeps its state in an explicit struct, so that there's
+ * no hidden global state, and any number of independent streams can be
+ * used at once. Each has a _seed() function, which expands a single
+ * 64-bit seed into a full state, and a _next() function, which returns
+ * 64 random bits.
+ *
+ * splitmix64: A 64-bit Weyl sequence, put through a mixing function.
+ *             Fast, but with only 64 bits of state. It's mainly used to
+ *             seed the others. (Steele, Lea and Flood, 2014.)
+ *
+ * xoshiro256**: A 256-bit xor/shift/rotate generator, with a multiply
+ *             and rotate to scramble the output. (Blackman and Vigna,
+ *             2018.)
+ *
+ * pcg64:      A 128-bit LCG, with the xor of the two halves rotated by
+ *             the top 6 bits for the output (PCG XSL-RR 128/64.)
+ *             (O'Neill, 2014.)
+ */
+struct splitmix64 {
+	unsigned long s;
+};
+
+struct xoshiro256 {
+	unsigned long s[4];
+};
+
+struct pcg64 {
+	unsigned long hi, lo;         /* State */
+	unsigned long inc_hi, inc_lo; /* Increment (must be odd) */
+};
+
+#define ROTL(X, K) (((X) << (K)) | ((X) >> (64 - (K))))
+
+/**
+ * Multiply two 64-bit numbers, returning the low 64 bits of the
+ * product, and storing the high 64 bits in *hi.
+ */
+unsigned long mul64(unsigned long a, unsigned long b, unsigned long *hi)
 {
-	int i,seq_len = 5;
-	unsigned long seed = (unsigned long)time(NULL);
+	#ifdef __SIZEOF_INT128__
+	uint128 p = (uint128)a * b;
+	*hi = (unsigned long)(p >> 64);
+	return (unsigned long)p;
+	#else
+	unsigned long ll, lh, hl, mid;
 
-	if (argc < 3) {
-		printf("%s <lower_bound> <upper_bound> [<seq_len>]\n", argv[0]);
-		printf("\tGenerate a sequence of random numbers\n");
-		printf("\tlower_bound:  Lower bound\n");
-		printf("\tupper_bound:  Upper bound\n");
-		printf("\tseq_len: Length of the sequence to generate\n");
-		exit(EXIT_FAILURE);
-	} else if (argc == 4) seq_len = atoi(argv[3]);
+	ll  = (a & 0xffffffffUL) * (b & 0xffffffffUL);
+	lh  = (a & 0xffffffffUL) * (b >> 32);
+	hl  = (a >> 32) * (b & 0xffffffffUL);
+	mid = (ll >> 32) + (lh & 0xffffffffUL) + (hl & 0xffffffffUL);
+	*hi = (a >> 32) * (b >> 32) + (lh >> 32) + (hl >> 32) + (mid >> 32);
+	return (mid << 32) | (ll & 0xffffffffUL);
+	#endif
+}
+
+/**
+ * Multiply two 128-bit numbers, mod 2^128, returning the low 64 bits of
+ * the product, and storing the high 64 bits in *hi.
+ */
+unsigned long mul128(unsigned long a_hi, unsigned long a_lo,
+                     unsigned long b_hi, unsigned long b_lo,
+                     unsigned long *hi)
+{
+	unsigned long lo = mul64(a_lo, b_lo, hi);
+
+	*hi += a_lo * b_hi + a_hi * b_lo;
+	return lo;
+}
+
+/**
+ * Return the index of the lowest set bit in x, which must be non-zero.
+ */
+int count_trailing_zeros(unsigned long x)
+{
+	#ifdef __GNUC__
+	return __builtin_ctzl(x);
+	#else
+	int n = 0;
+	while (!(x & 1)) { x >>= 1; n++; }
+	return n;
+	#endif
+}
+
+void splitmix64_seed(struct splitmix64 *g, unsigned long seed)
+{
+	g->s = seed;
+}
+
+/* The step of splitmix64's counter (the golden ratio) */
+#define SPLITMIX64_GAMMA 0x9e3779b97f4a7c15UL
+
+unsigned long splitmix64_next(struct splitmix64 *g)
+{
+	unsigned long z = (g->s += SPLITMIX64_GAMMA);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+	return z ^ (z >> 31);
+}
+
+void xoshiro256_seed(struct xoshiro256 *g, unsigned long seed)
+{
+	struct splitmix64 sm;
+	int i;
+
+	/* splitmix64 never gives four zeros in a row */
+	splitmix64_seed(&sm, seed);
+	for (i=0;i<4;i++) g->s[i] = splitmix64_next(&sm);
+}
+
+unsigned long xoshiro256_next(struct xoshiro256 *g)
+{
+	unsigned long *s = g->s;
+	unsigned long result = ROTL(s[1] * 5, 7) * 9, t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3]  = ROTL(s[3], 45);
+	return result;
+}
+
+/* The 128-bit PCG multiplier */
+#define PCG_MUL_HI 2549297995355413924UL
+#define PCG_MUL_LO 4865540595714422341UL
+
+/**
+ * Advance the PCG state: state = state * multiplier + increment, mod 2^128.
+ */
+void pcg64_step(struct pcg64 *g)
+{
+	unsigned long hi, lo;
+
+	lo    = mul128(g->hi, g->lo, PCG_MUL_HI, PCG_MUL_LO, &hi);
+	g->lo = lo + g->inc_lo;
+	g->hi = hi + g->inc_hi + (g->lo < lo);
+}
 
-	/* Generate the sequence */
-	printf("Generated: ");
-	for (i=0;i<seq_len;i++) {
-		printf((i < seq_len - 1) ? "%u," : "%u",
-		       my_rand(&seed,
-		               (unsigned int)atoi(argv[1]),
-		               (unsigned int)atoi(argv[2]))
-		);
+/**
+ * Seed with a 128-bit initial state and stream selector, as
+ * pcg64_srandom_r() does in the PCG reference code.
+ */
+void pcg64_seed128(struct pcg64 *g, unsigned long state_hi,
+                   unsigned long state_lo, unsigned long seq_hi,
+                   unsigned long seq_lo)
+{
+	g->hi     = 0;
+	g->lo     = 0;
+	g->inc_hi = (seq_hi << 1) | (seq_lo >> 63);
+	g->inc_lo = (seq_lo << 1) | 1;
+	pcg64_step(g);
+	g->lo += state_lo;
+	g->hi += state_hi + (g->lo < state_lo);
+	pcg64_step(g);
+}
+
+void pcg64_seed(struct pcg64 *g, unsigned long seed)
+{
+	struct splitmix64 sm;
+	unsigned long s[4];
+	int i;
+
+	splitmix64_seed(&sm, seed);
+	for (i=0;i<4;i++) s[i] = splitmix64_next(&sm);
+	pcg64_seed128(g, s[0], s[1], s[2], s[3]);
+}
+
+unsigned long pcg64_next(struct pcg64 *g)
+{
+	unsigned long x;
+	unsigned int rot;
+
+	pcg64_step(g);
+	x   = g->hi ^ g->lo;
+	rot = (unsigned int)(g->hi >> 58);
+	return rot ? (x >> rot) | (x << (64 - rot)) : x;
+}
+
+/**
+ * Jumping ahead
+ *
+ * Each generator can skip ahead n numbers in O(log n) time, so that a
+ * single seed can be split into non-overlapping subsequences, one per
+ * thread, which together give exactly the same numbers as one thread
+ * running through the whole sequence.
+ *
+ * splitmix64: The state is a counter, so just add n times its step.
+ *
+ * pcg64:      Applying the LCG n times is itself an LCG, whose
+ *             multiplier and increment are found by squaring, as in
+ *             Brown's "Random Number Generation with Arbitrary Strides"
+ *             (1994.)
+ *
+ * xoshiro256**: The state update is linear over GF(2), so it's a
+ *             256x256 bit matrix M. The matrices M^(2^k) are worked out
+ *             once, by squaring, and n steps are the product of those
+ *             for the bits set in n. xoshiro256_jump() is the fixed jump
+ *             of 2^128 steps from the reference code, which gives 2^128
+ *             independent streams of 2^128 numbers each.
+ */
+void splitmix64_advance(struct splitmix64 *g, unsigned long n)
+{
+	g->s += n * SPLITMIX64_GAMMA;
+}
+
+void pcg64_advance(struct pcg64 *g, unsigned long n)
+{
+	unsigned long acc_mul_hi = 0, acc_mul_lo = 1, acc_add_hi = 0;
+	unsigned long acc_add_lo = 0, mul_hi = PCG_MUL_HI, mul_lo = PCG_MUL_LO;
+	unsigned long add_hi = g->inc_hi, add_lo = g->inc_lo, hi, lo;
+
+	for (;n;n>>=1) {
+		if (n & 1) {
+			lo = mul128(acc_mul_hi, acc_mul_lo, mul_hi, mul_lo, &hi);
+			acc_mul_hi = hi; acc_mul_lo = lo;
+			lo = mul128(acc_add_hi, acc_add_lo, mul_hi, mul_lo, &hi);
+			acc_add_lo = lo + add_lo;
+			acc_add_hi = hi + add_hi + (acc_add_lo < lo);
+		}
+
+		/* add = (mul + 1) * add, mul = mul * mul */
+		lo = mul_lo + 1;
+		lo = mul128(mul_hi + (lo < mul_lo), lo, add_hi, add_lo, &add_hi);
+		add_lo = lo;
+		lo = mul128(mul_hi, mul_lo, mul_hi, mul_lo, &mul_hi);
+		mul_lo = lo;
 	}
-	printf("\n");
+
+	lo = mul128(acc_mul_hi, acc_mul_lo, g->hi, g->lo, &hi);
+	g->lo = lo + acc_add_lo;
+	g->hi = hi + acc_add_hi + (g->lo < lo);
+}
+
+void xoshiro256_jump(struct xoshiro256 *g)
+{
+	static const unsigned long jump[] = {
+		0x180ec6d33cfd0abaUL, 0xd5a61266f0c9392cUL,
+		0xa9582618e03fc9aaUL, 0x39abdc4529b1661cUL
+	};
+	unsigned long s[4] = { 0, 0, 0, 0 };
+	int i, b, k;
+
+	for (i=0;i<4;i++) {
+		for (b=0;b<64;b++) {
+			if (jump[i] & (1UL << b))
+				for (k=0;k<4;k++) s[k] ^= g->s[k];
+			xoshiro256_next(g);
+		}
+	}
+
+	memcpy(g->s, s, sizeof(s));
+}
+
+/**
+ * xoshiro_pow[k] is M^(2^k), stored by column: column j is the state
+ * after 2^k steps from a state with only bit j set.
+ */
+unsigned long (*xoshiro_pow)[256][4] = NULL;
+
+/**
+ * Multiply the vector v by the matrix m (by columns), into out.
+ */
+void gf2_apply(unsigned long (*m)[4], const unsigned long *v,
+               unsigned long *out)
+{
+	unsigned long r[4] = { 0, 0, 0, 0 }, bits;
+	int i, j, k;
+
+	for (i=0;i<4;i++) {
+		for (bits=v[i];bits;bits&=bits-1) {
+			j = i * 64 + count_trailing_zeros(bits);
+			for (k=0;k<4;k++) r[k] ^= m[j][k];
+		}
+	}
+
+	memcpy(out, r, sizeof(r));
+}
+
+/**
+ * Work out the jump matrices. Returns -1 if they can't be allocated.
+ */
+int xoshiro_pow_init(void)
+{
+	struct xoshiro256 g;
+	int j, k;
+
+	if (xoshiro_pow) return 0;
+	if (!(xoshiro_pow = malloc(64 * sizeof(*xoshiro_pow)))) return -1;
+
+	for (j=0;j<256;j++) {
+		memset(g.s, 0, sizeof(g.s));
+		g.s[j / 64] = 1UL << (j % 64);
+		xoshiro256_next(&g);
+		memcpy(xoshiro_pow[0][j], g.s, sizeof(g.s));
+	}
+
+	for (k=1;k<64;k++)
+		for (j=0;j<256;j++)
+			gf2_apply(xoshiro_pow[k - 1], xoshiro_pow[k - 1][j],
+			          xoshiro_pow[k][j]);
 	return 0;
 }
 
+void xoshiro256_advance(struct xoshiro256 *g, unsigned long n)
+{
+	int k;
+
+	/* Without the matrices, fall back to stepping */
+	if (xoshiro_pow_init()) {
+		for (;n;n--) xoshiro256_next(g);
+		return;
+	}
+
+	for (k=0;n;k++,n>>=1)
+		if (n & 1) gf2_apply(xoshiro_pow[k], g->s, g->s);
+}
+
+/**
+ * Bulk generation
+ *
+ * xoshiro256x4 runs four xoshiro256** generators side by side, with
+ * their states interleaved, so that the four steps are independent of
+ * each other and can run in parallel, either in the pipeline (the C
+ * kernel), or in one AVX2 register (the AVX2 kernel.) Its stream is
+ * the outputs of the four lanes in turn. Both kernels give the same
+ * stream, so the choice of kernel doesn't change the results.
+ *
+ * Uniform doubles in [0, 1) are made by putting the top 52 bits of a
+ * number into the mantissa of a double in [1, 2), and subtracting 1.
+ * This needs no int-to-double conversion, which AVX2 lacks for 64-bit
+ * integers.
+ */
+#define LANES 4
+
+struct xoshiro256x4 {
+	unsigned long s[4][LANES];  /* s[word][lane] */
+	unsigned long buf[LANES];   /* Outputs not yet returned */
+	int pos;                    /* Next output in buf */
+};
+
+/* The bit pattern of 1.0, and the mask for the mantissa */
+#define ONE_BITS 0x3ff0000000000000UL
+
+double bits_to_double(unsigned long x)
+{
+	union { unsigned long u; double d; } v;
+
+	v.u = (x >> 12) | ONE_BITS;
+	return v.d - 1.0;
+}
+
+/**
+ * Seed the lanes 2^128 steps apart, so that they never overlap.
+ */
+void xoshiro256x4_seed(struct xoshiro256x4 *g, unsigned long seed)
+{
+	struct xoshiro256 lane;
+	int i, j;
+
+	xoshiro256_seed(&lane, seed);
+	for (j=0;j<LANES;j++,xoshiro256_jump(&lane))
+		for (i=0;i<4;i++) g->s[i][j] = lane.s[i];
+	g->pos = LANES;
+}
+
+/**
+ * Fill out with n / LANES groups of outputs (n must be a multiple of
+ * LANES), as numbers, or as doubles if dbl is non-zero.
+ */
+void xoshiro256x4_fill_c(struct xoshiro256x4 *g, void *out, size_t n,
+                         int dbl)
+{
+	unsigned long s[4][LANES], r[LANES], t;
+	unsigned long *u = out;
+	double *d = out;
+	size_t i;
+	int j;
+
+	/* Work on a local copy, so the compiler knows out can't alias it */
+	memcpy(s, g->s, sizeof(s));
+	for (i=0;i<n;i+=LANES) {
+		for (j=0;j<LANES;j++) {
+			r[j] = ROTL(s[1][j] * 5, 7) * 9;
+			t = s[1][j] << 17;
+			s[2][j] ^= s[0][j];
+			s[3][j] ^= s[1][j];
+			s[1][j] ^= s[2][j];
+			s[0][j] ^= s[3][j];
+			s[2][j] ^= t;
+			s[3][j]  = ROTL(s[3][j], 45);
+		}
+
+		if (dbl) for (j=0;j<LANES;j++) d[i + j] = bits_to_double(r[j]);
+		else     for (j=0;j<LANES;j++) u[i + j] = r[j];
+	}
+	memcpy(g->s, s, sizeof(s));
+}
+
+#ifdef USE_SIMD
+/* Multiplies by 5 and 9 are shifts and adds, as AVX2 has no 64-bit mullo */
+#define ROTL256(X, K) \
+	_mm256_or_si256(_mm256_slli_epi64((X), (K)), _mm256_srli_epi64((X), 64 - (K)))
+
+__attribute__((target("avx2")))
+void xoshiro256x4_fill_avx2(struct xoshiro256x4 *g, void *out, size_t n,
+                            int dbl)
+{
+	__m256i s0, s1, s2, s3, r, t;
+	const __m256i one = _mm256_set1_epi64x((long)ONE_BITS);
+	const __m256d oned = _mm256_set1_pd(1.0);
+	char *p = out;
+	size_t i;
+
+	s0 = _mm256_loadu_si256((const __m256i *)g->s[0]);
+	s1 = _mm256_loadu_si256((const __m256i *)g->s[1]);
+	s2 = _mm256_loadu_si256((const __m256i *)g->s[2]);
+	s3 = _mm256_loadu_si256((const __m256i *)g->s[3]);
+
+	for (i=0;i<n;i+=LANES,p+=32) {
+		r = _mm256_add_epi64(_mm256_slli_epi64(s1, 2), s1);
+		r = ROTL256(r, 7);
+		r = _mm256_add_epi64(_mm256_slli_epi64(r, 3), r);
+		t = _mm256_slli_epi64(s1, 17);
+
+		s2 = _mm256_xor_si256(s2, s0);
+		s3 = _mm256_xor_si256(s3, s1);
+		s1 = _mm256_xor_si256(s1, s2);
+		s0 = _mm256_xor_si256(s0, s3);
+		s2 = _mm256_xor_si256(s2, t);
+		s3 = ROTL256(s3, 45);
+
+		if (dbl) {
+			r = _mm256_or_si256(_mm256_srli_epi64(r, 12), one);
+			_mm256_storeu_pd((double *)p,
+			                 _mm256_sub_pd(_mm256_castsi256_pd(r), oned));
+		} else _mm256_storeu_si256((__m256i *)p, r);
+	}
+
+	_mm256_storeu_si256((__m256i *)g->s[0], s0);
+	_mm256_storeu_si256((__m256i *)g->s[1], s1);
+	_mm256_storeu_si256((__m256i *)g->s[2], s2);
+	_mm256_storeu_si256((__m256i *)g->s[3], s3);
+}
+#endif /* USE_SIMD */
+
+/**
+ * The available fill kernels, slowest first. 'usable' is filled in by
+ * fill_init(), according to what the CPU supports.
+ */
+struct fill_kernel {
+	const char *name;
+	void (*fn)(struct xoshiro256x4 *, void *, size_t, int);
+	int usable;
+};
+
+struct fill_kernel fill_kernels[] = {
+	{ "c",    xoshiro256x4_fill_c,    1 },
+	#ifdef USE_SIMD
+	{ "avx2", xoshiro256x4_fill_avx2, 0 },
+	#endif
+	{ NULL,   NULL,                   0 }
+};
+
+/* The kernel picked by fill_init() */
+void (*fill_best)(struct xoshiro256x4 *, void *, size_t, int) = NULL;
+
+/**
+ * Check which kernels the CPU supports, and pick the fastest one.
+ */
+void fill_init(void)
+{
+	struct fill_kernel *k;
+
+	#ifdef USE_SIMD
+	__builtin_cpu_init();
+	fill_kernels[1].usable = __builtin_cpu_supports("avx2");
+	#endif
+
+	for (k=fill_kernels;k->name;k++)
+		if (k->usable) fill_best = k->fn;
+}
+
+/**
+ * Fill out with the next n outputs of the stream, as numbers, or as
+ * doubles if dbl is non-zero. Outputs left over from a partial group
+ * are kept for the next call.
+ */
+void xoshiro256x4_fill(struct xoshiro256x4 *g, void *out, size_t n, int dbl)
+{
+	unsigned long *u = out;
+	double *d = out;
+	size_t i = 0, bulk;
+
+	if (!fill_best) fill_init();
+	for (;i<n && g->pos<LANES;i++,g->pos++) {
+		if (dbl) d[i] = bits_to_double(g->buf[g->pos]);
+		else     u[i] = g->buf[g->pos];
+	}
+
+	bulk = (n - i) / LANES * LANES;
+	if (bulk) fill_best(g, dbl ? (void *)(d + i) : (void *)(u + i), bulk, dbl);
+
+	if ((i += bulk) < n) {
+		fill_best(g, g->buf, LANES, 0);
+		for (g->pos=0;i<n;i++,g->pos++) {
+			if (dbl) d[i] = bits_to_double(g->buf[g->pos]);
+			else     u[i] = g->buf[g->pos];
+		}
+	}
+}
+
+unsigned long xoshiro256x4_next(struct xoshiro256x4 *g)
+{
+	if (g->pos == LANES) {
+		if (!fill_best) fill_init();
+		fill_best(g, g->buf, LANES, 0);
+		g->pos = 0;
+	}
+
+	return g->buf[g->pos++];
+}
+
+/**
+ * Skip the next n outputs of the stream, by advancing each lane.
+ */
+void xoshiro256x4_advance(struct xoshiro256x4 *g, unsigned long n)
+{
+	struct xoshiro256 lane;
+	int i, j;
+
+	for (;n && g->pos<LANES;n--) g->pos++;
+	for (j=0;j<LANES && n>=LANES;j++) {
+		for (i=0;i<4;i++) lane.s[i] = g->s[i][j];
+		xoshiro256_advance(&lane, n / LANES);
+		for (i=0;i<4;i++) g->s[i][j] = lane.s[i];
+	}
+
+	if ((n %= LANES)) {
+		if (!fill_best) fill_init();
+		fill_best(g, g->buf, LANES, 0);
+		g->pos = (int)n;
+	}
+}
+
+/**
+ * my_rand() as a 64-bit generator, for the quality tests and the raw
+ * stream: each number is eight of its bytes (bounded to [0, 255].)
+ * Skipping ahead composes the LCG, as for pcg64.
+ */
+struct lcg {
+	unsigned long seed;
+};
+
+void lcg_seed(struct lcg *g, unsigned long seed)
+{
+	g->seed = seed;
+}
+
+unsigned long lcg_next(struct lcg *g)
+{
+	unsigned long x = 0;
+	int i;
+
+	for (i=0;i<8;i++) x = (x << 8) | my_rand(&g->seed, 0, 256);
+	return x;
+}
+
+void lcg_advance(struct lcg *g, unsigned long n)
+{
+	unsigned long acc_mul = 1, acc_add = 0, mul = 0x6fe5, add = 0x7ab9;
+
+	for (n*=8;n;n>>=1) {
+		if (n & 1) {
+			acc_mul *= mul;
+			acc_add  = acc_add * mul + add;
+		}
+		add *= mul + 1;
+		mul *= mul;
+	}
+
+	g->seed = g->seed * acc_mul + acc_add;
+}
+
+/**
+ * A generator, and the state for one stream of it.
+ *
+ * The table of generators lets the benchmark and the command line pick
+ * one by name. Calls through the table cost an indirect call per
+ * number, so bulk callers should use the fill functions, which make
+ * one indirect call per buffer.
+ */
+union rng_state {
+	struct splitmix64   sm;
+	struct xoshiro256   xo;
+	struct xoshiro256x4 x4;
+	struct pcg64        pcg;
+	struct lcg          lcg;
+};
+
+struct rng {
+	const char *name;
+	void (*seed)(union rng_state *, unsigned long);
+	unsigned long (*next)(union rng_state *);
+	void (*fill)(union rng_state *, unsigned long *, size_t);
+	void (*fill_double)(union rng_state *, double *, size_t);
+	void (*advance)(union rng_state *, unsigned long);
+};
+
+/* Define the table's functions for a generator, from its own functions */
+#define RNG_FUNCS(NAME, MEMBER)                                          \
+void rng_seed_##NAME(union rng_state *s, unsigned long seed)             \
+{                                                                        \
+	NAME##_seed(&s->MEMBER, seed);                                       \
+}                                                                        \
+                                                                         \
+unsigned long rng_next_##NAME(union rng_state *s)                        \
+{                                                                        \
+	return NAME##_next(&s->MEMBER);                                      \
+}                                                                        \
+                                                                         \
+void rng_fill_##NAME(union rng_state *s, unsigned long *out, size_t n)   \
+{                                                                        \
+	size_t i;                                                            \
+	for (i=0;i<n;i++) out[i] = NAME##_next(&s->MEMBER);                  \
+}                                                                        \
+                                                                         \
+void rng_fill_double_##NAME(union rng_state *s, double *out, size_t n)   \
+{                                                                        \
+	size_t i;                                                            \
+	for (i=0;i<n;i++) out[i] = bits_to_double(NAME##_next(&s->MEMBER));  \
+}                                                                        \
+                                                                         \
+void rng_advance_##NAME(union rng_state *s, unsigned long n)             \
+{                                                                        \
+	NAME##_advance(&s->MEMBER, n);                                       \
+}
+
+RNG_FUNCS(splitmix64, sm)
+RNG_FUNCS(xoshiro256, xo)
+RNG_FUNCS(pcg64, pcg)
+RNG_FUNCS(lcg, lcg)
+
+void rng_seed_xoshiro256x4(union rng_state *s, unsigned long seed)
+{
+	xoshiro256x4_seed(&s->x4, seed);
+}
+
+unsigned long rng_next_xoshiro256x4(union rng_state *s)
+{
+	return xoshiro256x4_next(&s->x4);
+}
+
+void rng_fill_xoshiro256x4(union rng_state *s, unsigned long *out, size_t n)
+{
+	xoshiro256x4_fill(&s->x4, out, n, 0);
+}
+
+void rng_fill_double_xoshiro256x4(union rng_state *s, double *out, size_t n)
+{
+	xoshiro256x4_fill(&s->x4, out, n, 1);
+}
+
+void rng_advance_xoshiro256x4(union rng_state *s, unsigned long n)
+{
+	xoshiro256x4_advance(&s->x4, n);
+}
+
+#define RNG_ENTRY(NAME) \
+	{ #NAME, rng_seed_##NAME, rng_next_##NAME, rng_fill_##NAME, \
+	  rng_fill_double_##NAME, rng_advance_##NAME }
+
+/* The first is the default */
+const struct rng rngs[] = {
+	RNG_ENTRY(xoshiro256),
+	RNG_ENTRY(xoshiro256x4),
+	RNG_ENTRY(pcg64),
+	RNG_ENTRY(splitmix64)
+};
+
+#define N_RNGS (sizeof(rngs) / sizeof(rngs[0]))
+
+/**
+ * my_rand(), for the quality tests and the raw stream. It's not in the
+ * table, since -g lcg keeps my_rand()'s own bounds.
+ */
+const struct rng lcg_rng = RNG_ENTRY(lcg);
+
+/**
+ * Find a generator by name, or return NULL.
+ */
+const struct rng *rng_find(const char *name)
+{
+	size_t i;
+
+	for (i=0;i<N_RNGS;i++)
+		if (!strcmp(rngs[i].name, name)) return &rngs[i];
+	return NULL;
+}
+
+/**
+ * Map 64 random bits to [0, range), without bias.
+ *
+ * This is Lemire's multiply-shift method ("Fast Random Integer
+ * Generation in an Interval", 2019): the high 64 bits of x * range are
+ * in [0, range), and are biased only when the low 64 bits fall below
+ * 2^64 mod range. Those values are rejected, and that remainder is only
+ * computed (with a division) when the low bits are small enough that
+ * they might be, which is rare unless range is huge.
+ *
+ * A range of 0 means the full 2^64.
+ */
+#define RNG_BOUNDED(NEXT, G, RANGE, OUT)                              \
+	do {                                                              \
+		unsigned long x_, lo_, t_;                                    \
+		x_ = NEXT(G);                                                 \
+		if (!(RANGE)) { (OUT) = x_; break; }                          \
+		lo_ = mul64(x_, (RANGE), &(OUT));                             \
+		if (lo_ < (RANGE)) {                                          \
+			t_ = (0 - (RANGE)) % (RANGE);                             \
+			while (lo_ < t_)                                          \
+				lo_ = mul64(NEXT(G), (RANGE), &(OUT));                \
+		}                                                             \
+	} while (0)
+
+/**
+ * Return a uniformly distributed number in [lbound, ubound].
+ */
+unsigned long rng_range(const struct rng *r, union rng_state *s,
+                        unsigned long lbound, unsigned long ubound)
+{
+	unsigned long v;
+
+	RNG_BOUNDED(r->next, s, ubound - lbound + 1, v);
+	return lbound + v;
+}
+
+/**
+ * Fill out with n numbers in [lbound, ubound], as rng_range() does, but
+ * drawing the numbers a buffer at a time. The rare rejected numbers are
+ * redrawn one at a time.
+ */
+void rng_fill_range(const struct rng *r, union rng_state *s,
+                    unsigned long *out, size_t n, unsigned long lbound,
+                    unsigned long ubound)
+{
+	unsigned long range = ubound - lbound + 1, lo, t;
+	size_t i;
+
+	r->fill(s, out, n);
+	if (!range) return;
+
+	t = (0 - range) % range;
+	for (i=0;i<n;i++) {
+		lo = mul64(out[i], range, &out[i]);
+		while (lo < t) lo = mul64(r->next(s), range, &out[i]);
+		out[i] += lbound;
+	}
+}
+
+/**
+ * Parallel fills
+ *
+ * rng_fill_parallel() splits a fill across threads, by giving each
+ * thread a copy of the state advanced to the start of its slice. The
+ * output, and the state afterwards, are exactly those of a fill on one
+ * thread, whatever the number of threads.
+ *
+ * For ranges, numbers that need redrawing take the next numbers after
+ * the whole fill, in order, just as rng_fill_range() does. So each
+ * thread only maps its slice up to its first rejected number, and the
+ * rest of the slice is mapped afterwards, in order, on one thread.
+ * Rejections are rare, so this is almost always no work at all.
+ */
+#define FILL_NUMBERS 0
+#define FILL_DOUBLES 1
+#define FILL_RANGE   2
+
+struct fill_job {
+	const struct rng *r;
+	union rng_state   st;
+	void             *out;
+	size_t            n;
+	int               kind;
+	unsigned long     lbound;
+	unsigned long     range;
+	unsigned long     reject;  /* 2^64 mod range */
+	size_t            mapped;  /* Numbers mapped before a rejection */
+};
+
+void *fill_worker(void *arg)
+{
+	struct fill_job *job = arg;
+	unsigned long *u = job->out, lo, hi;
+	size_t i;
+
+	if (job->kind == FILL_DOUBLES) {
+		job->r->fill_double(&job->st, job->out, job->n);
+		return NULL;
+	}
+
+	job->r->fill(&job->st, u, job->n);
+	job->mapped = job->n;
+	if (job->kind != FILL_RANGE || !job->range) return NULL;
+
+	for (i=0;i<job->n;i++) {
+		if ((lo = mul64(u[i], job->range, &hi)) < job->reject) {
+			job->mapped = i;
+			break;
+		}
+		u[i] = job->lbound + hi;
+	}
+
+	return NULL;
+}
+
+/**
+ * Fill out with n numbers (kind FILL_NUMBERS), doubles in [0, 1)
+ * (FILL_DOUBLES), or numbers in [lbound, ubound] (FILL_RANGE), using
+ * up to the given number of threads.
+ */
+void rng_fill_parallel(const struct rng *r, union rng_state *s, void *out,
+                       size_t n, int kind, unsigned long lbound,
+                       unsigned long ubound, int threads)
+{
+	struct fill_job jobs[MAX_THREADS];
+	size_t chunk, i, size;
+	unsigned long lo, *u;
+	int t;
+	#ifdef USE_POSIX
+	pthread_t tids[MAX_THREADS];
+	#endif
+
+	/* Slices are whole groups of lanes, and at least a block long */
+	if ((size_t)threads > n / FILL_BLOCK) threads = (int)(n / FILL_BLOCK);
+	if (threads > MAX_THREADS)            threads = MAX_THREADS;
+	if (threads < 1)                      threads = 1;
+
+	chunk = n / (size_t)threads / LANES * LANES;
+	size  = kind == FILL_DOUBLES ? sizeof(double) : sizeof(unsigned long);
+
+	for (t=0;t<threads;t++) {
+		jobs[t].r      = r;
+		jobs[t].out    = (char *)out + (size_t)t * chunk * size;
+		jobs[t].n      = t < threads - 1 ? chunk : n - (size_t)t * chunk;
+		jobs[t].kind   = kind;
+		jobs[t].lbound = lbound;
+		jobs[t].range  = ubound - lbound + 1;
+		jobs[t].reject = jobs[t].range ?
+		                 (0 - jobs[t].range) % jobs[t].range : 0;
+
+		/* Each slice starts where the one before it ends */
+		if (t) {
+			jobs[t].st = jobs[t - 1].st;
+			r->advance(&jobs[t].st, (unsigned long)chunk);
+		} else jobs[t].st = *s;
+	}
+
+	#ifdef USE_POSIX
+	for (t=1;t<threads;t++) {
+		if (pthread_create(&tids[t], NULL, fill_worker, &jobs[t]))
+			tids[t] = pthread_self();
+	}
+	#endif
+
+	fill_worker(&jobs[0]);
+
+	#ifdef USE_POSIX
+	for (t=1;t<threads;t++) {
+		if (pthread_equal(tids[t], pthread_self()))
+			fill_worker(&jobs[t]);
+		else pthread_join(tids[t], NULL);
+	}
+	#else
+	for (t=1;t<threads;t++) fill_worker(&jobs[t]);
+	#endif
+
+	/* Pick up where the last slice left off */
+	*s = jobs[threads - 1].st;
+	if (kind != FILL_RANGE || !jobs[0].range) return;
+
+	for (t=0;t<threads;t++) {
+		u = jobs[t].out;
+		for (i=jobs[t].mapped;i<jobs[t].n;i++) {
+			lo = mul64(u[i], jobs[t].range, &u[i]);
+			while (lo < jobs[t].reject)
+				lo = mul64(r->next(s), jobs[t].range, &u[i]);
+			u[i] += lbound;
+		}
+	}
+}
+
+#endif /* HAVE_RNG64 */
+
+/**
+ * Get the current time in seconds, for benchmarking.
+ */
+double bench_now(void)
+{
+	#ifdef USE_POSIX
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+	#else
+	return (double)clock() / CLOCKS_PER_SEC;
+	#endif
+}
+
+/**
+ * Time count numbers from each generator, with direct calls, then
+ * bounded to [0, 1000] with my_rand()'s range, and report the rate.
+ */
+void benchmark(long count)
+{
+	unsigned long seed = 1, sum, v;
+	unsigned long range = 1001;
+	long i;
+	double t;
+	#ifdef HAVE_RNG64
+	struct splitmix64 sm;
+	struct xoshiro256 xo;
+	struct pcg64 pcg;
+	union rng_state st;
+	size_t k;
+	#endif
+
+	printf("%-20s %9s %11s %12s\n", "Generator", "Time (s)", "ns/number",
+	       "numbers/ns");
+
+	#define BENCH_ROW(NAME, EXPR)                                          \
+		do {                                                           \
+			t = bench_now();                                           \
+			for (sum=0,i=0;i<count;i++) { EXPR; sum += v; }            \
+			t = bench_now() - t;                                       \
+			printf("%-20s %9.6f %11.3f %12.3f (checksum: %lu)\n",      \
+			       (NAME), t, t * 1e9 / count,                         \
+			       t > 0 ? count / (t * 1e9) : 0.0, sum);              \
+		} while (0)
+
+	BENCH_ROW("lcg", v = my_rand(&seed, 0, (unsigned int)range));
+
+	#ifdef HAVE_RNG64
+	splitmix64_seed(&sm, 1);
+	BENCH_ROW("splitmix64", v = splitmix64_next(&sm));
+	xoshiro256_seed(&xo, 1);
+	BENCH_ROW("xoshiro256", v = xoshiro256_next(&xo));
+	pcg64_seed(&pcg, 1);
+	BENCH_ROW("pcg64", v = pcg64_next(&pcg));
+
+	splitmix64_seed(&sm, 1);
+	BENCH_ROW("splitmix64/bounded", RNG_BOUNDED(splitmix64_next, &sm, range, v));
+	xoshiro256_seed(&xo, 1);
+	BENCH_ROW("xoshiro256/bounded", RNG_BOUNDED(xoshiro256_next, &xo, range, v));
+	pcg64_seed(&pcg, 1);
+	BENCH_ROW("pcg64/bounded", RNG_BOUNDED(pcg64_next, &pcg, range, v));
+
+	/* Through the table, as the command line does */
+	for (k=0;k<N_RNGS;k++) {
+		char name[32];
+		rngs[k].seed(&st, 1);
+		sprintf(name, "%s/range", rngs[k].name);
+		BENCH_ROW(name, v = rng_range(&rngs[k], &st, 0, range - 1));
+	}
+	#endif
+
+	#undef BENCH_ROW
+}
+
+/**
+ * Time filling a buffer with count numbers from each generator, as
+ * numbers, as doubles, and in [0, 1000], and report the throughput.
+ * Then time each of the xoshiro256x4 kernels directly.
+ */
+void benchmark_fill(long count)
+{
+	#ifdef HAVE_RNG64
+	const char *kinds[] = { "numbers", "doubles", "range" };
+	unsigned long *u, sum;
+	union rng_state st;
+	struct fill_kernel *k;
+	size_t i, j, n = FILL_BENCH;
+	double *d, t, dsum;
+	long done;
+	int kind;
+
+	u = calloc(n, sizeof(unsigned long));
+	d = calloc(n, sizeof(double));
+	if (!u || !d) {
+		fprintf(stderr, "Unable to allocate the benchmark buffers!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fill_init();
+	printf("%-20s %-8s %9s %9s %11s\n", "Generator", "Fill", "Time (s)",
+	       "GB/s", "ns/number");
+	for (i=0;i<N_RNGS+(sizeof(fill_kernels)/sizeof(fill_kernels[0])-1);i++) {
+		for (kind=0;kind<(i<N_RNGS?3:2);kind++) {
+			char name[32];
+			k = i < N_RNGS ? NULL : &fill_kernels[i - N_RNGS];
+			if (k && !k->usable) continue;
+
+			if (k) {
+				sprintf(name, "xoshiro256x4/%s", k->name);
+				xoshiro256x4_seed(&st.x4, 1);
+			} else {
+				strcpy(name, rngs[i].name);
+				rngs[i].seed(&st, 1);
+			}
+
+			t = bench_now();
+			for (done=0;done<count;done+=(long)n) {
+				if (k) k->fn(&st.x4, kind ? (void *)d : (void *)u, n, kind);
+				else if (kind == 0) rngs[i].fill(&st, u, n);
+				else if (kind == 1) rngs[i].fill_double(&st, d, n);
+				else rng_fill_range(&rngs[i], &st, u, n, 0, 1000);
+			}
+			t = bench_now() - t;
+
+			for (sum=0,dsum=0,j=0;j<n;j++) {
+				sum  += u[j];
+				dsum += d[j];
+			}
+
+			printf("%-20s %-8s %9.6f %9.3f %11.3f (checksum: ", name,
+			       kinds[kind], t, t > 0 ? (double)done * 8 / t / 1e9 : 0.0,
+			       t * 1e9 / done);
+			if (kind == 1) printf("%.3f)\n", dsum);
+			else           printf("%lu)\n", sum);
+		}
+	}
+
+	free(u);
+	free(d);
+	#else
+	(void)count;
+	printf("The bulk generators need a 64-bit unsigned long.\n");
+	#endif
+}
+
+/**
+ * Time parallel fills of count numbers from each generator, with 1 up
+ * to the given number of threads (doubling each step), and check that
+ * each gives the same numbers as one thread.
+ */
+void benchmark_parallel(long count, int threads)
+{
+	#ifdef HAVE_RNG64
+	const char *kinds[] = { "numbers", "doubles", "range" };
+	unsigned long *u, *ref;
+	union rng_state st;
+	double t, t1 = 0;
+	size_t k, n = (size_t)count;
+	int th, kind;
+
+	u   = malloc(n * sizeof(unsigned long));
+	ref = malloc(n * sizeof(unsigned long));
+	if (!u || !ref) {
+		fprintf(stderr, "Unable to allocate the benchmark buffers!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Fault the pages in, so the first run isn't penalized */
+	memset(u, 0, n * sizeof(unsigned long));
+	memset(ref, 0, n * sizeof(unsigned long));
+
+	printf("%-14s %-8s %7s %9s %9s %8s\n", "Generator", "Fill", "Threads",
+	       "Time (s)", "GB/s", "Speedup");
+	for (k=0;k<N_RNGS;k++) {
+		for (kind=0;kind<3;kind++) {
+			for (th=1;th<=threads;th=(th*2>threads && th<threads) ? threads : th*2) {
+				rngs[k].seed(&st, 1);
+				t = bench_now();
+				rng_fill_parallel(&rngs[k], &st, u, n, kind, 1, 1000, th);
+				t = bench_now() - t;
+
+				if (th == 1) {
+					memcpy(ref, u, n * sizeof(unsigned long));
+					t1 = t;
+				}
+
+				printf("%-14s %-8s %7d %9.6f %9.3f %8.2f%s\n", rngs[k].name,
+				       kinds[kind], th, t,
+				       t > 0 ? (double)n * 8 / t / 1e9 : 0.0,
+				       t > 0 ? t1 / t : 0.0,
+				       memcmp(u, ref, n * sizeof(unsigned long)) ?
+				       " (MISMATCH)" : "");
+			}
+		}
+	}
+
+	free(ref);
+	free(u);
+	#else
+	(void)count; (void)threads;
+	printf("The bulk generators need a 64-bit unsigned long.\n");
+	#endif
+}
+
+#ifdef HAVE_RNG64
+/**
+ * Statistical tests
+ *
+ * These are quick checks of a generator's output, after Knuth (TAOCP
+ * vol. 2, 3.3.2) and Marsaglia's Diehard, to compare generators side by
+ * side with their speed. They're no substitute for a full battery, so
+ * rand -r writes the raw stream for PractRand or TestU01 too.
+ *
+ * Each test returns its statistic, and stores the p-value in *p. A
+ * p-value very close to 0 or 1 means the output doesn't look random.
+ * The p-values use normal approximations, which are good enough to
+ * tell a passing generator from a failing one, but not much more.
+ */
+#define TEST_BLOCK 4096
+
+/**
+ * P(Z > z) for a standard normal Z, from the erfc() approximation in
+ * Numerical Recipes (accurate to about 1e-7.)
+ */
+double normal_tail(double z)
+{
+	double x = fabs(z) / sqrt(2.0), t = 1.0 / (1.0 + 0.5 * x), r;
+
+	r = t * exp(-x * x - 1.26551223 + t * (1.00002368 + t * (0.37409196 +
+	    t * (0.09678418 + t * (-0.18628806 + t * (0.27886807 +
+	    t * (-1.13520398 + t * (1.48851587 + t * (-0.82215223 +
+	    t * 0.17087277)))))))));
+	return z >= 0 ? r / 2 : 1 - r / 2;
+}
+
+/**
+ * P(X > x) for X chi-square distributed with df degrees of freedom,
+ * with the Wilson-Hilferty approximation.
+ */
+double chi2_tail(double x, double df)
+{
+	double v = 2.0 / (9.0 * df);
+	return normal_tail((pow(x / df, 1.0 / 3.0) - (1.0 - v)) / sqrt(v));
+}
+
+/**
+ * Count the top 10 bits of n numbers into 1024 buckets, and compare the
+ * counts with the expected n / 1024 (chi-square.)
+ */
+double test_buckets(const struct rng *r, union rng_state *s, long n,
+                    double *p)
+{
+	unsigned long buf[TEST_BLOCK], counts[1024];
+	double chi2 = 0, e = (double)n / 1024, d;
+	long i, j, k;
+
+	memset(counts, 0, sizeof(counts));
+	for (i=0;i<n;i+=k) {
+		k = n - i < TEST_BLOCK ? n - i : TEST_BLOCK;
+		r->fill(s, buf, (size_t)k);
+		for (j=0;j<k;j++) counts[buf[j] >> 54]++;
+	}
+
+	for (i=0;i<1024;i++) {
+		d     = (double)counts[i] - e;
+		chi2 += d * d / e;
+	}
+
+	*p = chi2_tail(chi2, 1023);
+	return chi2;
+}
+
+/**
+ * The correlation between each of n doubles and the next. For random
+ * numbers, it's close to -1 / (n - 1), with a standard deviation of
+ * about 1 / sqrt(n).
+ */
+double test_serial(const struct rng *r, union rng_state *s, long n,
+                   double *p)
+{
+	double buf[TEST_BLOCK], sum = 0, sum2 = 0, prod = 0, first = 0;
+	double prev = 0, corr, z;
+	long i, j, k;
+
+	for (i=0;i<n;i+=k) {
+		k = n - i < TEST_BLOCK ? n - i : TEST_BLOCK;
+		r->fill_double(s, buf, (size_t)k);
+		for (j=0;j<k;j++) {
+			if (i + j) prod += prev * buf[j];
+			else       first = buf[j];
+			sum  += buf[j];
+			sum2 += buf[j] * buf[j];
+			prev  = buf[j];
+		}
+	}
+
+	/* The last number is paired with the first */
+	prod += prev * first;
+	corr  = (n * prod - sum * sum) / (n * sum2 - sum * sum);
+	z     = (corr + 1.0 / (n - 1)) * sqrt((double)n);
+	*p    = normal_tail(z);
+	return corr;
+}
+
+/**
+ * Sort n 24-bit numbers, with a radix sort of 8 bits per pass (three
+ * passes, which leaves the result in tmp, so swap back at the end.)
+ */
+void sort24(unsigned long *a, unsigned long *tmp, int n)
+{
+	unsigned long *from = a, *to = tmp, *t;
+	int count[257], i, shift;
+
+	for (shift=0;shift<24;shift+=8) {
+		memset(count, 0, sizeof(count));
+		for (i=0;i<n;i++) count[((from[i] >> shift) & 255) + 1]++;
+		for (i=1;i<257;i++) count[i] += count[i - 1];
+		for (i=0;i<n;i++) to[count[(from[i] >> shift) & 255]++] = from[i];
+		t = from; from = to; to = t;
+	}
+
+	memcpy(a, from, (size_t)n * sizeof(*a));
+}
+
+/**
+ * Marsaglia's birthday spacings test: pick 512 birthdays in a year of
+ * 2^24 days (24 bits of each number, from bit 'shift'), sort them, and
+ * count the repeated spacings between them. That count is Poisson
+ * distributed with a mean of 512^3 / (4 * 2^24) = 2. The counts from
+ * n / 512 years are added up, and compared with their mean.
+ */
+double test_birthday(const struct rng *r, union rng_state *s, long n,
+                     int shift, double *p)
+{
+	unsigned long days[512], tmp[512];
+	long years = n / 512, i, dups = 0;
+	int j;
+
+	for (i=0;i<years;i++) {
+		r->fill(s, days, 512);
+		for (j=0;j<512;j++) days[j] = (days[j] >> shift) & 0xffffff;
+		sort24(days, tmp, 512);
+
+		for (j=511;j>0;j--) days[j] -= days[j - 1];
+		sort24(days, tmp, 512);
+		for (j=1;j<512;j++) dups += (days[j] == days[j - 1]);
+	}
+
+	*p = normal_tail((dups - 2.0 * years) / sqrt(2.0 * years));
+	return (double)dups;
+}
+
+/**
+ * Knuth's gap test: the lengths of the gaps between doubles in
+ * [0, 1/16) should be geometrically distributed. Gaps of 0 to 63, and
+ * 64 or longer, are counted, and compared with the expected counts
+ * (chi-square.)
+ */
+double test_gap(const struct rng *r, union rng_state *s, long n, double *p)
+{
+	double buf[TEST_BLOCK], chi2 = 0, e, q = 1.0 / 16, d;
+	unsigned long counts[65], gaps = 0, gap = 0;
+	long i, j, k;
+
+	memset(counts, 0, sizeof(counts));
+	for (i=0;i<n;i+=k) {
+		k = n - i < TEST_BLOCK ? n - i : TEST_BLOCK;
+		r->fill_double(s, buf, (size_t)k);
+		for (j=0;j<k;j++) {
+			if (buf[j] >= q) gap++;
+			else {
+				counts[gap < 64 ? gap : 64]++;
+				gaps++;
+				gap = 0;
+			}
+		}
+	}
+
+	for (i=0;i<=64;i++) {
+		e = gaps * (i < 64 ? q * pow(1 - q, (double)i) : pow(1 - q, 64.0));
+		d = (double)counts[i] - e;
+		chi2 += d * d / e;
+	}
+
+	*p = chi2_tail(chi2, 64);
+	return chi2;
+}
+
+/**
+ * Run the tests over count numbers from each generator, and my_rand(),
+ * and report the results, along with the time taken per number.
+ */
+void quality(long count, unsigned long seed)
+{
+	const char *tests[] = { "buckets", "serial", "birthday/hi",
+	                        "birthday/lo", "gap" };
+	unsigned long buf[TEST_BLOCK], sum = 0;
+	union rng_state st;
+	const struct rng *r;
+	double t, stat = 0, p = 0;
+	size_t k;
+	long i;
+	int j;
+
+	printf("%-14s %-12s %14s %9s %s\n", "Generator", "Test", "Statistic",
+	       "p-value", "Result");
+	for (k=0;k<=N_RNGS;k++) {
+		r = k < N_RNGS ? &rngs[k] : &lcg_rng;
+
+		/* Speed first, in blocks, as the tests draw them */
+		r->seed(&st, seed);
+		t = bench_now();
+		for (i=0;i<count;i+=TEST_BLOCK) {
+			r->fill(&st, buf, TEST_BLOCK);
+			sum += buf[0];
+		}
+		t = bench_now() - t;
+		printf("%-14s %-12s %14.3f %9s %s\n", r->name, "ns/number",
+		       t * 1e9 / i, "", "");
+
+		for (j=0;j<5;j++) {
+			r->seed(&st, seed);
+			switch (j) {
+				case 0: stat = test_buckets(r, &st, count, &p); break;
+				case 1: stat = test_serial(r, &st, count, &p); break;
+				case 2: stat = test_birthday(r, &st, count, 40, &p); break;
+				case 3: stat = test_birthday(r, &st, count, 0, &p); break;
+				case 4: stat = test_gap(r, &st, count, &p); break;
+			}
+
+			printf("%-14s %-12s %14.6f %9.6f %s\n", r->name, tests[j], stat,
+			       p, p < 0.001 || p > 0.999 ? "FAIL" : "pass");
+		}
+	}
+
+	/* Keep the speed loop from being optimized away */
+	if (!sum) printf("\n");
+}
+
+/**
+ * Write the raw numbers from a generator to stdout, in native byte
+ * order, until count numbers (or forever, if count is 0), or until the
+ * reader goes away. For PractRand: rand -r xoshiro256 | RNG_test stdin64
+ */
+int raw_stream(const struct rng *r, unsigned long seed, long count)
+{
+	unsigned long buf[TEST_BLOCK];
+	union rng_state st;
+	size_t n = TEST_BLOCK;
+	long done;
+
+	r->seed(&st, seed);
+	for (done=0;!count || done<count;done+=(long)n) {
+		if (count && count - done < TEST_BLOCK) n = (size_t)(count - done);
+		r->fill(&st, buf, n);
+		if (fwrite(buf, sizeof(buf[0]), n, stdout) != n) return EXIT_FAILURE;
+	}
+
+	return 0;
+}
+
+/**
+ * Non-uniform samplers
+ *
+ * Each sampler has a _from() function, which turns a first random
+ * number x into a sample, drawing any more numbers it needs from the
+ * generator; a function for one sample; and a _fill() function, which
+ * draws the first numbers a block at a time.
+ *
+ * normal, exponential: Ziggurat, as reformulated with doubles by Doornik
+ *     ("An Improved Ziggurat Method to Generate Normal Random Samples",
+ *     2005), after Marsaglia and Tsang (2000.) The density is covered by
+ *     equal-area strips, and almost all samples are a table lookup and
+ *     a multiply. The layer comes from the low bits of x, and the
+ *     position in it from the high bits, so the two are independent.
+ *
+ * alias:  Walker's alias method, with Vose's O(n) setup: each of the n
+ *     outcomes gets a column of height 1, split between itself and at
+ *     most one "alias", so a sample is a column and a coin flip.
+ *
+ * zipf:   Rejection-inversion (Hoermann and Derflinger, 1996), which
+ *     samples from [1, n] with P(k) proportional to k^-s in O(1)
+ *     expected time, without tables, for any n.
+ *
+ * shuffle, reservoir: Fisher-Yates, and Li's Algorithm L (1994), which
+ *     samples k items from a stream of unknown length, skipping over
+ *     the items it won't take rather than drawing for each of them.
+ */
+#define SAMPLE_BLOCK 1024
+
+/* 2^-52, and a double in (0, 1), for the logarithms */
+#define TWO_M52 (1.0 / 4503599627370496.0)
+#define OPEN_DOUBLE(X) (((double)((X) >> 12) + 0.5) * TWO_M52)
+
+#define ZIG_NORMAL_N 128
+#define ZIG_NORMAL_R 3.442619855899
+#define ZIG_NORMAL_V 9.91256303526217e-3
+
+#define ZIG_EXP_N 256
+#define ZIG_EXP_R 7.69711747013104972
+#define ZIG_EXP_V 3.949659822581572e-3
+
+/**
+ * The ziggurat tables: the strips' right edges (x), x[i + 1] / x[i]
+ * (ratio), and the density at each edge (f). 'ready' is set once
+ * they've been worked out, by zig_init().
+ */
+struct zig_tables {
+	double x[ZIG_EXP_N + 1];
+	double ratio[ZIG_EXP_N];
+	double f[ZIG_EXP_N + 1];
+	int ready;
+};
+
+struct zig_tables zig_normal, zig_exp;
+
+double density_normal(double x) { return exp(-0.5 * x * x); }
+double density_exp(double x)    { return exp(-x); }
+
+/**
+ * Work out the strips of a ziggurat with n strips of area v, the first
+ * of which has the tail beyond r. Each strip's edge is where the density
+ * is the strip's area over its width higher than the last.
+ */
+void zig_setup(struct zig_tables *z, int n, double r, double v,
+               double (*f)(double), int normal)
+{
+	double y;
+	int i;
+
+	z->x[0] = v / f(r);
+	z->x[1] = r;
+	z->x[n] = 0;
+	for (i=2;i<n;i++) {
+		y       = v / z->x[i - 1] + f(z->x[i - 1]);
+		z->x[i] = normal ? sqrt(-2.0 * log(y)) : -log(y);
+	}
+
+	for (i=0;i<n;i++)  z->ratio[i] = z->x[i + 1] / z->x[i];
+	for (i=0;i<=n;i++) z->f[i]     = f(z->x[i]);
+	z->ready = 1;
+}
+
+void zig_init(void)
+{
+	if (!zig_normal.ready)
+		zig_setup(&zig_normal, ZIG_NORMAL_N, ZIG_NORMAL_R, ZIG_NORMAL_V,
+		          density_normal, 1);
+	if (!zig_exp.ready)
+		zig_setup(&zig_exp, ZIG_EXP_N, ZIG_EXP_R, ZIG_EXP_V, density_exp, 0);
+}
+
+double normal_from(const struct rng *r, union rng_state *s, unsigned long x)
+{
+	const struct zig_tables *z = &zig_normal;
+	double u, v, a, b;
+	int i;
+
+	for (;;x=r->next(s)) {
+		u = 2.0 * bits_to_double(x) - 1.0;
+		i = (int)(x & (ZIG_NORMAL_N - 1));
+		if (fabs(u) < z->ratio[i]) return u * z->x[i];
+
+		/* The tail, by Marsaglia's method */
+		if (!i) {
+			do {
+				a = log(OPEN_DOUBLE(r->next(s))) / ZIG_NORMAL_R;
+				b = log(OPEN_DOUBLE(r->next(s)));
+			} while (-2.0 * b < a * a);
+			return u < 0 ? a - ZIG_NORMAL_R : ZIG_NORMAL_R - a;
+		}
+
+		/* The wedge between the strip and the curve */
+		v = u * z->x[i];
+		if (z->f[i] + bits_to_double(r->next(s)) * (z->f[i + 1] - z->f[i]) <
+		    density_normal(v))
+			return v;
+	}
+}
+
+double exp_from(const struct rng *r, union rng_state *s, unsigned long x)
+{
+	const struct zig_tables *z = &zig_exp;
+	double u, v;
+	int i;
+
+	for (;;x=r->next(s)) {
+		u = bits_to_double(x);
+		i = (int)(x & (ZIG_EXP_N - 1));
+		if (u < z->ratio[i]) return u * z->x[i];
+
+		/* The tail is memoryless */
+		if (!i) return ZIG_EXP_R - log(OPEN_DOUBLE(r->next(s)));
+
+		v = u * z->x[i];
+		if (z->f[i] + bits_to_double(r->next(s)) * (z->f[i + 1] - z->f[i]) <
+		    density_exp(v))
+			return v;
+	}
+}
+
+double sample_normal(const struct rng *r, union rng_state *s)
+{
+	return normal_from(r, s, r->next(s));
+}
+
+double sample_exp(const struct rng *r, union rng_state *s)
+{
+	return exp_from(r, s, r->next(s));
+}
+
+/**
+ * Define the _fill() function for a sampler, which takes the extra
+ * argument ARG (declared as DECL), and gives samples of type TYPE.
+ * FAST(X, OUT) is the sampler's fast path, and leaves OUT alone when
+ * X needs the slow path (which is _from()), or NULL for none.
+ */
+#define SAMPLE_FILL(NAME, TYPE, DECL, ARG, FAST)                         \
+void NAME##_fill(const struct rng *r, union rng_state *s DECL,           \
+                 TYPE *out, size_t n)                                    \
+{                                                                        \
+	unsigned long buf[SAMPLE_BLOCK];                                     \
+	size_t i, j, k;                                                      \
+                                                                         \
+	for (i=0;i<n;i+=k) {                                                 \
+		k = n - i < SAMPLE_BLOCK ? n - i : SAMPLE_BLOCK;                 \
+		r->fill(s, buf, k);                                              \
+		for (j=0;j<k;j++) {                                              \
+			FAST(buf[j], out[i + j]);                                    \
+			else out[i + j] = NAME##_from(r, s ARG, buf[j]);             \
+		}                                                                \
+	}                                                                    \
+}
+
+#define NO_ARG
+#define COMMA(X) , X
+#define NO_FAST(X, OUT) if (0) (void)(X)
+
+/**
+ * The fast paths: an inner strip, which is all but 1-2% of the time.
+ * These are here to keep the common case out of a function call.
+ */
+#define NORMAL_FAST(X, OUT)                                              \
+	double u_ = 2.0 * bits_to_double(X) - 1.0;                           \
+	int i_ = (int)((X) & (ZIG_NORMAL_N - 1));                            \
+	if (fabs(u_) < zig_normal.ratio[i_]) (OUT) = u_ * zig_normal.x[i_]
+
+#define EXP_FAST(X, OUT)                                                 \
+	double u_ = bits_to_double(X);                                       \
+	int i_ = (int)((X) & (ZIG_EXP_N - 1));                               \
+	if (u_ < zig_exp.ratio[i_]) (OUT) = u_ * zig_exp.x[i_]
+
+SAMPLE_FILL(normal, double, NO_ARG, NO_ARG, NORMAL_FAST)
+SAMPLE_FILL(exp, double, NO_ARG, NO_ARG, EXP_FAST)
+
+/**
+ * An alias table for n outcomes: outcome i is picked with probability
+ * prob[i] when its column is picked, and alias[i] otherwise.
+ */
+struct alias_table {
+	size_t         n;
+	double        *prob;
+	unsigned long *alias;
+};
+
+void alias_free(struct alias_table *t)
+{
+	free(t->prob);
+	free(t->alias);
+	t->prob  = NULL;
+	t->alias = NULL;
+}
+
+/**
+ * Build the table for n outcomes with the given (non-negative) weights.
+ * Returns -1 if the weights are all 0, or memory runs out.
+ *
+ * The columns are scaled to an average height of 1, and split into
+ * those below 1 (small) and the rest (large.) Each small column is
+ * topped up from a large one, which becomes its alias, and which then
+ * goes back on the list it now belongs to.
+ */
+int alias_init(struct alias_table *t, const double *w, size_t n)
+{
+	unsigned long *small, *large, ns = 0, nl = 0, i, j;
+	double sum = 0, *p;
+
+	t->n     = n;
+	t->prob  = malloc(n * sizeof(double));
+	t->alias = malloc(n * sizeof(unsigned long));
+	small    = malloc(n * sizeof(unsigned long));
+	large    = malloc(n * sizeof(unsigned long));
+	for (i=0;i<n;i++) sum += w[i];
+
+	if (!t->prob || !t->alias || !small || !large || !n || sum <= 0) {
+		alias_free(t);
+		free(small);
+		free(large);
+		return -1;
+	}
+
+	for (p=t->prob,i=0;i<n;i++) {
+		p[i] = w[i] * (double)n / sum;
+		t->alias[i] = i;
+		if (p[i] < 1.0) small[ns++] = i;
+		else            large[nl++] = i;
+	}
+
+	while (ns && nl) {
+		i = small[--ns];
+		j = large[nl - 1];
+		t->alias[i] = j;
+		p[j] -= 1.0 - p[i];
+		if (p[j] < 1.0) {
+			nl--;
+			small[ns++] = j;
+		}
+	}
+
+	/* What's left is 1, give or take rounding */
+	while (nl) p[large[--nl]] = 1.0;
+	while (ns) p[small[--ns]] = 1.0;
+
+	free(small);
+	free(large);
+	return 0;
+}
+
+/**
+ * The column comes from the high bits of x (as in Lemire's method, but
+ * the tiny bias for huge tables is ignored), and the coin from the low
+ * bits of the product, which are uniform in [0, 1) too.
+ *
+ * The coin is a coin toss, so a branch on it would be mispredicted
+ * often. Loading the alias first lets the compiler use a cmov instead,
+ * which is over twice as fast.
+ */
+unsigned long alias_from(const struct rng *r, union rng_state *s,
+                         const struct alias_table *t, unsigned long x)
+{
+	unsigned long i, a, lo = mul64(x, (unsigned long)t->n, &i);
+	int heads;
+
+	(void)r; (void)s;
+	a     = t->alias[i];
+	heads = bits_to_double(lo) < t->prob[i];
+	return heads ? i : a;
+}
+
+unsigned long sample_alias(const struct rng *r, union rng_state *s,
+                           const struct alias_table *t)
+{
+	return alias_from(r, s, t, r->next(s));
+}
+
+SAMPLE_FILL(alias, unsigned long, COMMA(const struct alias_table *t), COMMA(t),
+            NO_FAST)
+
+/**
+ * Zipf's distribution over [1, n] with exponent s > 0, and the
+ * constants for rejection-inversion.
+ */
+struct zipf {
+	unsigned long n;
+	double        s;
+	double        h_x1;    /* H(1.5) - 1 */
+	double        h_n;     /* H(n + 0.5) */
+	double        squeeze;
+};
+
+/* log(1 + x) / x and (exp(x) - 1) / x, accurate near 0 */
+double log1p_over(double x)
+{
+	double y = 1.0 + x;
+
+	if (fabs(x) < 1e-8) return 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+	return (log(y) - ((y - 1.0) - x) / y) / x;
+}
+
+double expm1_over(double x)
+{
+	double y = exp(x);
+
+	if (fabs(x) < 1e-8) return 1.0 + x * 0.5 * (1.0 + x / 3.0 * (1.0 + 0.25 * x));
+	return (y - 1.0) / log(y);
+}
+
+/* The hat function h(x) = x^-s, its integral H, and H's inverse */
+double zipf_h(const struct zipf *z, double x)
+{
+	return exp(-z->s * log(x));
+}
+
+double zipf_hint(const struct zipf *z, double x)
+{
+	double l = log(x);
+	return expm1_over((1.0 - z->s) * l) * l;
+}
+
+double zipf_hinv(const struct zipf *z, double x)
+{
+	double t = x * (1.0 - z->s);
+
+	if (t < -1.0) t = -1.0;
+	return exp(log1p_over(t) * x);
+}
+
+void zipf_init(struct zipf *z, unsigned long n, double s)
+{
+	z->n       = n ? n : 1;
+	z->s       = s;
+	z->h_x1    = zipf_hint(z, 1.5) - 1.0;
+	z->h_n     = zipf_hint(z, (double)z->n + 0.5);
+	z->squeeze = 2.0 - zipf_hinv(z, zipf_hint(z, 2.5) - zipf_h(z, 2.0));
+}
+
+/**
+ * Invert the integral of the hat at a uniform point, round to the
+ * nearest k, and accept it if it's under the histogram of k^-s, which
+ * is almost always.
+ */
+unsigned long zipf_from(const struct rng *r, union rng_state *s,
+                        const struct zipf *z, unsigned long x)
+{
+	double u, v;
+	unsigned long k;
+
+	for (;;x=r->next(s)) {
+		u = z->h_n + bits_to_double(x) * (z->h_x1 - z->h_n);
+		v = zipf_hinv(z, u);
+		k = v < 1.0 ? 1 : (unsigned long)(v + 0.5);
+		if (k > z->n) k = z->n;
+
+		if ((double)k - v <= z->squeeze ||
+		    u >= zipf_hint(z, (double)k + 0.5) - zipf_h(z, (double)k))
+			return k;
+	}
+}
+
+unsigned long sample_zipf(const struct rng *r, union rng_state *s,
+                          const struct zipf *z)
+{
+	return zipf_from(r, s, z, r->next(s));
+}
+
+SAMPLE_FILL(zipf, unsigned long, COMMA(const struct zipf *z), COMMA(z),
+            NO_FAST)
+
+/**
+ * Shuffle a in place (Fisher-Yates), or with k < n, just pick a random
+ * k of its items into a[0..k-1], in random order.
+ */
+void shuffle(const struct rng *r, union rng_state *s, unsigned long *a,
+             size_t n, size_t k)
+{
+	unsigned long j, t;
+	size_t i;
+
+	for (i=0;i<k && i+1<n;i++) {
+		RNG_BOUNDED(r->next, s, (unsigned long)(n - i), j);
+		j += i;
+		t = a[i]; a[i] = a[j]; a[j] = t;
+	}
+}
+
+/**
+ * Pick k items at random from a stream of n items (n needn't be known
+ * in advance, as only the items taken are looked at), into res.
+ * Returns the number picked, which is less than k if n < k.
+ *
+ * After the first k, the next item taken is a geometrically distributed
+ * number of items further on, and replaces a random one of the k.
+ */
+size_t reservoir(const struct rng *r, union rng_state *s,
+                 const unsigned long *stream, size_t n, unsigned long *res,
+                 size_t k)
+{
+	double w, skip;
+	size_t i;
+	unsigned long j;
+
+	for (i=0;i<k && i<n;i++) res[i] = stream[i];
+	if (i < k) return i;
+
+	w = exp(log(OPEN_DOUBLE(r->next(s))) / (double)k);
+	for (i=k-1;;) {
+		skip = log(OPEN_DOUBLE(r->next(s))) / log(1.0 - w);
+		if (skip >= (double)(n - i - 1)) break;
+		i += (size_t)skip + 1;
+
+		RNG_BOUNDED(r->next, s, (unsigned long)k, j);
+		res[j] = stream[i];
+		w *= exp(log(OPEN_DOUBLE(r->next(s))) / (double)k);
+	}
+
+	return k;
+}
+
+/**
+ * Benchmark the samplers with xoshiro256, one at a time and by the
+ * block, over count samples each. The mean and variance are there to
+ * check that the samples look right: 0 and 1 for the normal, 1 and 1
+ * for the exponential, and so on.
+ */
+void benchmark_dist(long count)
+{
+	const char *names[] = { "normal", "normal/fill", "exponential",
+	                        "exponential/fill", "zipf", "zipf/fill", "alias",
+	                        "alias/fill", "shuffle", "reservoir" };
+	struct alias_table at;
+	struct zipf zf;
+	const struct rng *r = &rngs[0];
+	union rng_state st;
+	double *d, *w, t, sum, sq, v;
+	unsigned long *u, *res;
+	size_t n = (size_t)count, i, m = 1000, k = 1000;
+	int row;
+
+	d   = malloc(n * sizeof(double));
+	u   = malloc(n * sizeof(unsigned long));
+	w   = malloc(m * sizeof(double));
+	res = malloc(k * sizeof(unsigned long));
+	if (!d || !u || !w || !res) {
+		fprintf(stderr, "Unable to allocate the benchmark buffers!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Zipf's law over a million items, and 1/k weights for the alias table */
+	zig_init();
+	zipf_init(&zf, 1000000, 1.1);
+	for (i=0;i<m;i++) w[i] = 1.0 / (double)(i + 1);
+	if (alias_init(&at, w, m)) {
+		fprintf(stderr, "Unable to build the alias table!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-20s %9s %11s %10s %10s %10s\n", "Sampler", "Time (s)",
+	       "Msamples/s", "ns/sample", "Mean", "Variance");
+	for (row=0;row<10;row++) {
+		r->seed(&st, 1);
+		t = bench_now();
+		switch (row) {
+			case 0: for (i=0;i<n;i++) d[i] = sample_normal(r, &st); break;
+			case 1: normal_fill(r, &st, d, n); break;
+			case 2: for (i=0;i<n;i++) d[i] = sample_exp(r, &st); break;
+			case 3: exp_fill(r, &st, d, n); break;
+			case 4: for (i=0;i<n;i++) u[i] = sample_zipf(r, &st, &zf); break;
+			case 5: zipf_fill(r, &st, &zf, u, n); break;
+			case 6: for (i=0;i<n;i++) u[i] = sample_alias(r, &st, &at); break;
+			case 7: alias_fill(r, &st, &at, u, n); break;
+			case 8:
+				for (i=0;i<n;i++) u[i] = i;
+				t = bench_now();
+				shuffle(r, &st, u, n, n);
+				break;
+			case 9: reservoir(r, &st, u, n, res, k); break;
+		}
+		t = bench_now() - t;
+
+		/* The reservoir only takes k samples, but looks at all n */
+		for (sum=sq=0,i=0;i<(row == 9 ? k : n);i++) {
+			v    = row < 4 ? d[i] : (double)(row == 9 ? res[i] : u[i]);
+			sum += v;
+			sq  += v * v;
+		}
+		sum /= (double)i;
+
+		printf("%-20s %9.6f %11.3f %10.3f %10.4f %10.4g\n", names[row], t,
+		       t > 0 ? (double)n / t / 1e6 : 0.0, t * 1e9 / (double)n, sum,
+		       sq / (double)i - sum * sum);
+	}
+
+	alias_free(&at);
+	free(res);
+	free(w);
+	free(u);
+	free(d);
+}
+
+/**
+ * Print count samples from a distribution, one per line:
+ *
+ *     normal, exp:     The standard normal and exponential distributions
+ *     zipf:<n>:<s>:    Zipf's distribution over [1, n] with exponent s
+ *     alias:<w>,...:   0 through n - 1, weighted by the n weights given
+ *     shuffle:<n>:     1 through n, shuffled (count is ignored)
+ *     sample:<k>:<n>:  k of 1 through n, by reservoir sampling
+ *
+ * Returns EXIT_FAILURE if spec is invalid, or count is negative.
+ */
+int distribution(const struct rng *r, unsigned long seed, const char *spec,
+                 long count)
+{
+	struct alias_table at;
+	struct zipf zf;
+	union rng_state st;
+	double buf[SAMPLE_BLOCK], *w = NULL, s;
+	unsigned long ubuf[SAMPLE_BLOCK], *a, *res, k, n, i, j, m;
+	const char *p;
+	char *end;
+
+	if (count < 0) return EXIT_FAILURE;
+
+	r->seed(&st, seed);
+	zig_init();
+	if (!strcmp(spec, "normal") || !strcmp(spec, "exp")) {
+		for (i=0;i<(unsigned long)count;i+=SAMPLE_BLOCK) {
+			m = count - i < SAMPLE_BLOCK ? count - i : SAMPLE_BLOCK;
+			if (spec[0] == 'n') normal_fill(r, &st, buf, m);
+			else exp_fill(r, &st, buf, m);
+			for (j=0;j<m;j++) printf("%.17g\n", buf[j]);
+		}
+		return 0;
+	}
+
+	if (!strncmp(spec, "zipf:", 5)) {
+		n = strtoul(spec + 5, &end, 10);
+		if (*end != ':' || (s = strtod(end + 1, &end)) <= 0 || *end)
+			return EXIT_FAILURE;
+		zipf_init(&zf, n, s);
+		for (i=0;i<(unsigned long)count;i+=SAMPLE_BLOCK) {
+			m = count - i < SAMPLE_BLOCK ? count - i : SAMPLE_BLOCK;
+			zipf_fill(r, &st, &zf, ubuf, m);
+			for (j=0;j<m;j++) printf("%lu\n", ubuf[j]);
+		}
+		return 0;
+	}
+
+	if (!strncmp(spec, "alias:", 6)) {
+		for (n=1,p=spec+6;*p;p++) n += *p == ',';
+		if (!(w = malloc(n * sizeof(double)))) return EXIT_FAILURE;
+		for (p=spec+6,i=0;i<n;i++,p=end+1) {
+			w[i] = strtod(p, &end);
+			if (w[i] < 0 || end == p || (*end && *end != ',')) break;
+		}
+
+		if (i < n || alias_init(&at, w, n)) {
+			free(w);
+			return EXIT_FAILURE;
+		}
+
+		for (i=0;i<(unsigned long)count;i+=SAMPLE_BLOCK) {
+			m = count - i < SAMPLE_BLOCK ? count - i : SAMPLE_BLOCK;
+			alias_fill(r, &st, &at, ubuf, m);
+			for (j=0;j<m;j++) printf("%lu\n", ubuf[j]);
+		}
+
+		alias_free(&at);
+		free(w);
+		return 0;
+	}
+
+	if (!strncmp(spec, "shuffle:", 8) || !strncmp(spec, "sample:", 7)) {
+		k = strtoul(strchr(spec, ':') + 1, &end, 10);
+		n = k;
+		if (spec[1] == 'a' && (*end != ':' || !(n = strtoul(end + 1, &end, 10))))
+			return EXIT_FAILURE;
+		if (*end || !n) return EXIT_FAILURE;
+
+		a   = malloc(n * sizeof(unsigned long));
+		res = malloc((k ? k : 1) * sizeof(unsigned long));
+		if (!a || !res) {
+			free(a);
+			free(res);
+			return EXIT_FAILURE;
+		}
+
+		for (i=0;i<n;i++) a[i] = i + 1;
+		if (spec[1] == 'a') k = reservoir(r, &st, a, n, res, k);
+		else {
+			shuffle(r, &st, a, n, n);
+			memcpy(res, a, n * sizeof(unsigned long));
+		}
+
+		for (i=0;i<k;i++) printf("%lu\n", res[i]);
+		free(res);
+		free(a);
+		return 0;
+	}
+
+	return EXIT_FAILURE;
+}
+#endif /* HAVE_RNG64 */
+
+/* Pairs of decimal digits, "00" through "99" */
+const char digit_pairs[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/**
+ * Write the decimal digits of v into buf, two at a time, and return
+ * how many were written. No NUL is appended. main() uses this to print
+ * a sequence a block at a time, instead of calling printf() per number.
+ */
+size_t format_ulong(char *buf, unsigned long v)
+{
+	char tmp[24], *p = tmp + sizeof(tmp);
+	unsigned long i;
+
+	while (v >= 100) {
+		i  = (v % 100) * 2;
+		v /= 100;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	}
+
+	if (v >= 10) {
+		*--p = digit_pairs[v * 2 + 1];
+		*--p = digit_pairs[v * 2];
+	} else *--p = (char)('0' + v);
+
+	memcpy(buf, p, (size_t)(tmp + sizeof(tmp) - p));
+	return (size_t)(tmp + sizeof(tmp) - p);
+}
+
+void usage(const char *arg0)
+{
+	printf("%s [-g <generator>] [-s <seed>] [-t <threads>] [-o] "
+	       "<lower_bound> <upper_bound> [<seq_len>]\n", arg0);
+	printf("%s -b [count]\n", arg0);
+	printf("%s -bf [count]\n", arg0);
+	printf("%s -bp [count [threads]]\n", arg0);
+	printf("%s -bd [count]\n", arg0);
+	printf("%s [-g <generator>] [-s <seed>] -d <distribution> [count]\n", arg0);
+	printf("%s [-s <seed>] -q [count]\n", arg0);
+	printf("%s [-g <generator>] [-s <seed>] -r [count]\n", arg0);
+	printf("\tGenerate a sequence of random numbers\n");
+	printf("\tgenerator:    lcg");
+	#ifdef HAVE_RNG64
+	{
+		size_t i;
+		for (i=0;i<N_RNGS;i++) printf(", %s", rngs[i].name);
+		printf(" (default: %s)", rngs[0].name);
+	}
+	#endif
+	printf("\n");
+	printf("\t-s:           Seed (default: the current time)\n");
+	printf("\t-t:           Generate with several threads (the numbers "
+	       "are the same)\n");
+	printf("\t-o:           Print one number per line, with no prefix\n");
+	printf("\tlower_bound:  Lower bound\n");
+	printf("\tupper_bound:  Upper bound (inclusive, except for lcg)\n");
+	printf("\tseq_len: Length of the sequence to generate\n");
+	printf("\t-b:      Benchmark the generators over count numbers\n");
+	printf("\t-bf:     Benchmark the fill functions over count numbers\n");
+	printf("\t-bp:     Benchmark parallel fills of count numbers\n");
+	printf("\t-bd:     Benchmark the samplers over count samples\n");
+	printf("\t-d:      Print count samples (default: 10) from a "
+	       "distribution:\n");
+	printf("\t         normal, exp, zipf:<n>:<s>, alias:<w>,<w>,..., "
+	       "shuffle:<n>,\n\t         sample:<k>:<n>\n");
+	printf("\t-q:      Test the quality of each generator over count "
+	       "numbers\n");
+	printf("\t-r:      Write count raw 64-bit numbers (default: no limit) "
+	       "to stdout\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	long i, j, n, seq_len = 5;
+	unsigned long seed = (unsigned long)time(NULL);
+	unsigned long lbound, ubound, *nums;
+	const char *gen = NULL, *arg0 = argv[0];
+	static char buf[OUT_BUF];
+	int legacy, lines = 0, threads = 1, mode = 0;
+	size_t len = 0;
+	#ifdef HAVE_RNG64
+	const struct rng *r = &rngs[0];
+	const char *dist = NULL;
+	union rng_state st;
+	#endif
+
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		benchmark(argc > 2 ? atol(argv[2]) : BENCH_COUNT);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-bf")) {
+		benchmark_fill(argc > 2 ? atol(argv[2]) : BENCH_COUNT * 4);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-bd")) {
+		#ifdef HAVE_RNG64
+		benchmark_dist(argc > 2 ? atol(argv[2]) : BENCH_COUNT / 10);
+		#else
+		printf("The samplers need a 64-bit unsigned long.\n");
+		#endif
+		return 0;
+	}
+
+	#ifdef USE_POSIX
+	if (argc > 1 && !strcmp(argv[1], "-bp")) {
+		threads = argc > 3 ? atoi(argv[3]) :
+		          (int)sysconf(_SC_NPROCESSORS_ONLN);
+	#else
+	if (argc > 1 && !strcmp(argv[1], "-bp")) {
+		threads = argc > 3 ? atoi(argv[3]) : 1;
+	#endif
+		benchmark_parallel(argc > 2 ? atol(argv[2]) : BENCH_COUNT / 4,
+		                   threads < 1 ? 1 : threads);
+		return 0;
+	}
+
+	/* Options */
+	for (;argc > 1 && argv[1][0] == '-' && argv[1][1] && !isdigit(argv[1][1]);
+	     argc--,argv++) {
+		if (!strcmp(argv[1], "-o")) lines = 1;
+		else if (!strcmp(argv[1], "-q") || !strcmp(argv[1], "-r"))
+			mode = argv[1][1];
+		else if (!strcmp(argv[1], "-g") && argc > 2) {
+			gen = argv[2];
+			argc--; argv++;
+		} else if (!strcmp(argv[1], "-d") && argc > 2) {
+			#ifdef HAVE_RNG64
+			dist = argv[2];
+			#endif
+			mode = 'd';
+			argc--; argv++;
+		} else if (!strcmp(argv[1], "-s") && argc > 2) {
+			seed = strtoul(argv[2], NULL, 0);
+			argc--; argv++;
+		} else if (!strcmp(argv[1], "-t") && argc > 2) {
+			threads = atoi(argv[2]);
+			argc--; argv++;
+		} else usage(arg0);
+	}
+
+	#ifdef HAVE_RNG64
+	if (mode == 'q') {
+		quality(argc > 1 ? atol(argv[1]) : BENCH_COUNT / 10, seed);
+		return 0;
+	}
+
+	if (mode == 'r') {
+		if (gen && strcmp(gen, "lcg") && !(r = rng_find(gen))) usage(arg0);
+		return raw_stream(gen && !strcmp(gen, "lcg") ? &lcg_rng : r, seed,
+		                  argc > 1 ? atol(argv[1]) : 0);
+	}
+
+	if (mode == 'd') {
+		if (gen && !(r = rng_find(gen))) usage(arg0);
+		if (argc > 1 && atol(argv[1]) < 0) usage(arg0);
+		if (distribution(r, seed, dist, argc > 1 ? atol(argv[1]) : 10)) {
+			fprintf(stderr, "Invalid distribution: %s\n", dist);
+			return EXIT_FAILURE;
+		}
+		return 0;
+	}
+	#else
+	if (mode) {
+		printf("The 64-bit generators need a 64-bit unsigned long.\n");
+		return EXIT_FAILURE;
+	}
+	#endif
+
+	if (argc < 3) usage(arg0);
+	else if (argc == 4) seq_len = atol(argv[3]);
+
+	lbound = strtoul(argv[1], NULL, 10);
+	ubound = strtoul(argv[2], NULL, 10);
+
+	legacy = gen && !strcmp(gen, "lcg");
+	#ifdef HAVE_RNG64
+	if (!legacy) {
+		if ((gen && !(r = rng_find(gen))) || lbound > ubound) usage(arg0);
+		r->seed(&st, seed);
+	}
+	#else
+	if (gen && !legacy) usage(arg0);
+	legacy = 1;
+	#endif
+
+	/* No more of a block than the sequence needs */
+	n = seq_len < 1 ? 1 : seq_len < SEQ_BLOCK ? seq_len : SEQ_BLOCK;
+	if (!(nums = malloc((size_t)n * sizeof(unsigned long)))) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/**
+	 * Generate the sequence a block at a time, and format it into the
+	 * buffer, flushing the buffer as it fills.
+	 */
+	if (!lines) printf("Generated: ");
+	for (i=0;i<seq_len;i+=n) {
+		n = seq_len - i < SEQ_BLOCK ? seq_len - i : SEQ_BLOCK;
+		if (legacy) {
+			for (j=0;j<n;j++)
+				nums[j] = my_rand(&seed, (unsigned int)lbound,
+				                  (unsigned int)ubound);
+		}
+		#ifdef HAVE_RNG64
+		else rng_fill_parallel(r, &st, nums, (size_t)n, FILL_RANGE, lbound,
+		                       ubound, threads);
+		#endif
+
+		for (j=0;j<n;j++) {
+			if (len > sizeof(buf) - 32) {
+				fwrite(buf, 1, len, stdout);
+				len = 0;
+			}
+
+			len += format_ulong(buf + len, nums[j]);
+			if (lines) buf[len++] = '\n';
+			else if (i + j < seq_len - 1) buf[len++] = ',';
+		}
+	}
+
+	if (!lines) buf[len++] = '\n';
+	fwrite(buf, 1, len, stdout);
+	free(nums);
+	return 0;
+}
@@ -7,119 +7,1249 @@
  *
  * Compiling: gcc -ansi -pedantic -Wall -W -O2 -o strrev strrev.c
  * Defines:
- *     USE_C: Use the C variant of strrev (default for non-x86 arches.)
+ *     USE_C:     Use the C variants of strrev (default for non-x86 arches.)
+ *     USE_POSIX: Enable the file modes and the multi-threaded variant, and
+ *                use clock_gettime() for the benchmark timer. Link with
+ *                -lpthread.
  *
  * Running:
  *     tim@cid ~ $ ./strrev "deo vindice"
  *     Reversing: deo vindice
  *     Result:    ecidniv oed
+ *     tim@cid ~ $ ./strrev -u "$(printf 'caf\303\251')" | tail -1 | od -c
+ *     0000000   R   e   s   u   l   t   :                 303 251   f   a   c
+ *     0000020  \n
+ *     0000021
+ *     tim@cid ~ $ ./strrev -b 65536
+ *     Kernel         Size  Time (s)      GB/s
+ *     bytes            16  0.480685     2.234
+ *     ...
  */
+#ifdef USE_POSIX
+#define _XOPEN_SOURCE 600
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#ifdef USE_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#endif
 
 /**
  * There's no one standard with regard to how 'asm' and
  * 'volatile' are implemented by the compiler.
+ *
+ * Note that __asm__ and __volatile__ are keywords rather than macros
+ * in GCC, so we have to check for GCC itself.
  */
-#if !defined(asm) && defined(__asm__)
+#if !defined(asm) && (defined(__asm__) || defined(__GNUC__))
 #define asm __asm__
 #elif !defined(USE_C)
 #define USE_C
 #endif
 
-#if !defined(volatile) && defined (__volatile__)
+#if !defined(volatile) && (defined(__volatile__) || defined(__GNUC__))
 #define volatile __volatile__
 #elif !defined(USE_C)
 #define USE_C
 #endif
 
 /**
- * Reverse a string in-place
+ * The SIMD kernels need a compiler that supports per-function target
+ * attributes, and the CPU feature builtins, so that the right kernel
+ * can be picked at runtime.
+ */
+#if !defined(USE_C) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define USE_SIMD
+#include <immintrin.h>
+#endif
+
+/* Bytes to process for each benchmark step (1 GiB) */
+#define BENCH_BYTES 0x40000000UL
+
+/* Size of the blocks read when streaming a file */
+#define STREAM_BLOCK 0x100000UL
+
+/* Maximum number of threads, and default chunk size for memrev_parallel() */
+#define MAX_THREADS 64
+#define PAR_CHUNK   0x100000UL
+
+/* Byte-swap an unsigned long (the builtins arrived in GCC 4.3) */
+#if defined(__clang__) || (defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 3)))
+#define HAVE_BSWAP
+#endif
+#if defined(HAVE_BSWAP) && ULONG_MAX == 0xffffffffUL
+#define BSWAP(X) __builtin_bswap32(X)
+#elif defined(HAVE_BSWAP) && ULONG_MAX > 0xffffffffUL
+#define BSWAP(X) __builtin_bswap64(X)
+#else
+#define BSWAP(X) bswap_long(X)
+#endif
+
+/**
+ * Reverse the bytes of an unsigned long, for compilers without a
+ * byte-swap builtin.
+ */
+unsigned long bswap_long(unsigned long x)
+{
+	unsigned long r = 0; unsigned int i;
+
+	for (i=0;i<sizeof(unsigned long);i++) {
+		r = (r << CHAR_BIT) | (x & UCHAR_MAX);
+		x >>= CHAR_BIT;
+	}
+
+	return r;
+}
+
+/**
+ * Reverse a buffer in-place, a byte at a time
  *
  * Here, I present two ways for doing so. One written in
- * assembly (x86_64 and x86), the other in plain C. The
- * assembly version is much more optimal than the C version, simpler too,
- * despite the fact that the C version looks simpler.
+ * assembly (x86_64 and x86), the other in plain C. Both simply swap
+ * bytes from either end, moving toward the middle.
  *
- * The C version of this function can be written a few different ways.
- * One is what I've written here, and another might very well be nearly
- * the same, but using a temporary variable to hold a byte while swapping.
+ * Note that we avoid 'xchg' with a memory operand, since it carries an
+ * implicit 'lock' prefix, which makes it surprisingly slow.
+ *
+ * This is only used on its own for short buffers. The other kernels
+ * below use it for whatever's left in the middle of the buffer.
  *
  * NOTE: the '.intel_syntax' directive requires binutils >= 2.10.
  *
  */
-char *strrev(char *str)
+void memrev_bytes(char *buf, size_t len)
 {
+	char *start = buf;
+	char *end   = buf + len - 1;
+	if (len < 2) return;
+
 	#if !defined(USE_C) && defined(__x86_64__)
 	asm volatile(
 		".intel_syntax noprefix\n\t"
-		/* Load a byte from the beginning of the string */
+		"1:\n\t"
+		/* Load a byte from each end of the buffer */
 		"mov al,[rsi]\n\t"
-		/* Exchange this with a byte from the end of the string */
-		"xchg al,[rdi]\n\t"
-		/* Store the byte from the end at the beginning */
-		"mov [rsi],al\n\t"
+		"mov dl,[rdi]\n\t"
+		/* Store them at the opposite ends */
+		"mov [rsi],dl\n\t"
+		"mov [rdi],al\n\t"
 		/* Decrement rdi */
 		"dec rdi\n\t"
 		/* Increment rsi */
 		"inc rsi\n\t"
 		/* When rsi >= rdi, there are no bytes left to swap */
 		"cmp rsi,rdi\n\t"
-		"jcs $-15\n\t"
+		"jb 1b\n\t"
 		".att_syntax\n\t"
-		: /* No outputs */
-		: "S"(str), "D"(str + strlen(str) - 1)
-		: "flags"
+		: "+S"(start), "+D"(end)
+		: /* No other inputs */
+		: "eax", "edx", "cc", "memory"
 	);
 	#elif !defined(USE_C) && defined(__i386__)
 	asm volatile(
 		".intel_syntax noprefix\n\t"
-		/* Load a byte from the beginning of the string */
+		"1:\n\t"
+		/* Load a byte from each end of the buffer */
 		"mov al,[esi]\n\t"
-		/* Exchange this with a byte from the end of the string */
-		"xchg al,[edi]\n\t"
-		/* Store the byte from the end at the beginning */
-		"mov [esi],al\n\t"
+		"mov dl,[edi]\n\t"
+		/* Store them at the opposite ends */
+		"mov [esi],dl\n\t"
+		"mov [edi],al\n\t"
 		/* Decrement edi */
 		"dec edi\n\t"
 		/* Increment esi */
 		"inc esi\n\t"
 		/* When esi >= edi, there are no bytes left to swap */
 		"cmp esi,edi\n\t"
-		"jcs $-10\n\t"
+		"jb 1b\n\t"
 		".att_syntax\n\t"
-		: /* No outputs */
-		: "S"(str), "D"(str + strlen(str) - 1)
-		: "flags"
+		: "+S"(start), "+D"(end)
+		: /* No other inputs */
+		: "eax", "edx", "cc", "memory"
 	);
 	#else /* USE_C */
-	char *start = str;
-	char *end   = str + strlen(str) - 1;
 	while (start < end) {
-		*start ^= *end;
-		*end   ^= *start;
-		*start ^= *end;
-		start++; end--;
+		char tmp = *start;
+		*start++ = *end;
+		*end--   = tmp;
 	}
 	#endif
+}
+
+/**
+ * Reverse a buffer in-place, a word at a time
+ *
+ * This is the portable fallback. We load a word from each end of the
+ * buffer, byte-swap both, and store them at the opposite ends. Once
+ * less than two words remain, one more pair of overlapping words
+ * finishes the job. That's safe, since both words are loaded before
+ * either one is stored.
+ *
+ * memcpy() is used for the loads and stores, since the words needn't
+ * be aligned. Any decent compiler will turn these into plain moves.
+ */
+void memrev_words(char *buf, size_t len)
+{
+	const size_t w = sizeof(unsigned long);
+	char *lo = buf, *hi = buf + len;
+	unsigned long a, b;
+
+	while ((size_t)(hi - lo) >= w) {
+		memcpy(&a, lo, w);
+		memcpy(&b, hi - w, w);
+		a = BSWAP(a); b = BSWAP(b);
+		memcpy(lo, &b, w);
+		memcpy(hi - w, &a, w);
+		if ((size_t)(hi - lo) < 2 * w) return;
+		lo += w; hi -= w;
+	}
 
-	return str;
+	memrev_bytes(lo, (size_t)(hi - lo));
+}
+
+/**
+ * Swap two regions of a buffer, reversing both: a[i] <-> b[n - 1 - i].
+ *
+ * These are the counterparts of the memrev kernels, used to reverse a
+ * buffer in separate pieces (see memrev_parallel().) Reversing a whole
+ * buffer is the same as swapping its first and last halves.
+ */
+void memswap_bytes(char *a, char *b, size_t n)
+{
+	char *hi = b + n, tmp;
+
+	while (n--) {
+		tmp  = *a;
+		*a++ = *--hi;
+		*hi  = tmp;
+	}
+}
+
+void memswap_words(char *a, char *b, size_t n)
+{
+	const size_t w = sizeof(unsigned long);
+	char *hi = b + n;
+	unsigned long x, y;
+
+	for (;n>=w;n-=w,a+=w,hi-=w) {
+		memcpy(&x, a, w);
+		memcpy(&y, hi - w, w);
+		x = BSWAP(x); y = BSWAP(y);
+		memcpy(a, &y, w);
+		memcpy(hi - w, &x, w);
+	}
+
+	memswap_bytes(a, b, n);
+}
+
+/**
+ * Count the ASCII bytes at the start of a buffer, a word at a time.
+ *
+ * A word is all ASCII when none of its bytes have the high bit set.
+ */
+size_t ascii_prefix_words(const char *buf, size_t len)
+{
+	const unsigned long high = (~0UL / UCHAR_MAX) << (CHAR_BIT - 1);
+	size_t i = 0; unsigned long w;
+
+	while (len - i >= sizeof(unsigned long)) {
+		memcpy(&w, buf + i, sizeof(unsigned long));
+		if (w & high) break;
+		i += sizeof(unsigned long);
+	}
+
+	while (i < len && !(buf[i] & 0x80)) i++;
+	return i;
+}
+
+#ifdef USE_SIMD
+/**
+ * SIMD kernels
+ *
+ * These work the same way as memrev_words(), 16 or 32 bytes at a
+ * time, and hand whatever's left (less than one vector) over to
+ * memrev_words().
+ *
+ * SSE2 lacks a byte shuffle, so we have to reverse the dwords, then
+ * the words in each dword, then the bytes in each word. SSSE3's
+ * pshufb does it in one go. AVX2's vpshufb only shuffles within each
+ * 128-bit lane, so the lanes are swapped afterward.
+ */
+#define MEMREV_SIMD(TYPE, LOAD, STORE, REV)                  \
+	const size_t w = sizeof(TYPE);                           \
+	char *lo = buf, *hi = buf + len;                         \
+	TYPE a, b;                                               \
+	                                                         \
+	while ((size_t)(hi - lo) >= w) {                         \
+		a = LOAD((const TYPE *)lo);                          \
+		b = LOAD((const TYPE *)(hi - w));                    \
+		STORE((TYPE *)lo, REV(b));                           \
+		STORE((TYPE *)(hi - w), REV(a));                     \
+		if ((size_t)(hi - lo) < 2 * w) return;               \
+		lo += w; hi -= w;                                    \
+	}                                                        \
+	                                                         \
+	memrev_words(lo, (size_t)(hi - lo))
+
+#define MEMSWAP_SIMD(TYPE, LOAD, STORE, REV)                 \
+	const size_t w = sizeof(TYPE);                           \
+	char *hi = b + n;                                        \
+	TYPE x, y;                                               \
+	                                                         \
+	for (;n>=w;n-=w,a+=w,hi-=w) {                            \
+		x = LOAD((const TYPE *)a);                           \
+		y = LOAD((const TYPE *)(hi - w));                    \
+		STORE((TYPE *)a, REV(y));                            \
+		STORE((TYPE *)(hi - w), REV(x));                     \
+	}                                                        \
+	                                                         \
+	memswap_words(a, b, n)
+
+__attribute__((target("sse2")))
+__m128i rev_sse2(__m128i v)
+{
+	v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("ssse3")))
+__m128i rev_ssse3(__m128i v)
+{
+	return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+	                                        8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+__attribute__((target("avx2")))
+__m256i rev_avx2(__m256i v)
+{
+	v = _mm256_shuffle_epi8(v, _mm256_set_epi8(
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+__attribute__((target("sse2")))
+void memrev_sse2(char *buf, size_t len)
+{
+	MEMREV_SIMD(__m128i, _mm_loadu_si128, _mm_storeu_si128, rev_sse2);
+}
+
+__attribute__((target("ssse3")))
+void memrev_ssse3(char *buf, size_t len)
+{
+	MEMREV_SIMD(__m128i, _mm_loadu_si128, _mm_storeu_si128, rev_ssse3);
+}
+
+__attribute__((target("avx2")))
+void memrev_avx2(char *buf, size_t len)
+{
+	MEMREV_SIMD(__m256i, _mm256_loadu_si256, _mm256_storeu_si256, rev_avx2);
+}
+
+__attribute__((target("sse2")))
+void memswap_sse2(char *a, char *b, size_t n)
+{
+	MEMSWAP_SIMD(__m128i, _mm_loadu_si128, _mm_storeu_si128, rev_sse2);
+}
+
+__attribute__((target("ssse3")))
+void memswap_ssse3(char *a, char *b, size_t n)
+{
+	MEMSWAP_SIMD(__m128i, _mm_loadu_si128, _mm_storeu_si128, rev_ssse3);
+}
+
+__attribute__((target("avx2")))
+void memswap_avx2(char *a, char *b, size_t n)
+{
+	MEMSWAP_SIMD(__m256i, _mm256_loadu_si256, _mm256_storeu_si256, rev_avx2);
+}
+
+/**
+ * The same as ascii_prefix_words(), using pmovmskb to collect the high
+ * bits of each byte in a vector.
+ */
+__attribute__((target("sse2")))
+size_t ascii_prefix_sse2(const char *buf, size_t len)
+{
+	size_t i = 0;
+
+	while (len - i >= 16 && !_mm_movemask_epi8(
+	       _mm_loadu_si128((const __m128i *)(buf + i)))) i += 16;
+	return i + ascii_prefix_words(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t ascii_prefix_avx2(const char *buf, size_t len)
+{
+	size_t i = 0;
+
+	while (len - i >= 32 && !_mm256_movemask_epi8(
+	       _mm256_loadu_si256((const __m256i *)(buf + i)))) i += 32;
+	return i + ascii_prefix_words(buf + i, len - i);
+}
+#endif /* USE_SIMD */
+
+/**
+ * The available kernels, slowest first. 'usable' is filled in by
+ * memrev_init(), according to what the CPU supports.
+ */
+struct memrev_kernel {
+	const char *name;
+	void (*fn)(char *, size_t);
+	void (*swap)(char *, char *, size_t);
+	int usable;
+};
+
+struct memrev_kernel memrev_kernels[] = {
+	{ "bytes", memrev_bytes, memswap_bytes, 1 },
+	{ "words", memrev_words, memswap_words, 1 },
+	#ifdef USE_SIMD
+	{ "sse2",  memrev_sse2,  memswap_sse2,  0 },
+	{ "ssse3", memrev_ssse3, memswap_ssse3, 0 },
+	{ "avx2",  memrev_avx2,  memswap_avx2,  0 },
+	#endif
+	{ NULL,    NULL,         NULL,          0 }
+};
+
+/* The kernels picked by memrev_init() */
+void (*memrev_best)(char *, size_t) = NULL;
+void (*memswap_best)(char *, char *, size_t) = NULL;
+size_t (*ascii_prefix)(const char *, size_t) = ascii_prefix_words;
+
+/**
+ * Check which kernels the CPU supports, and pick the fastest one.
+ */
+void memrev_init(void)
+{
+	struct memrev_kernel *k;
+
+	#ifdef USE_SIMD
+	__builtin_cpu_init();
+	memrev_kernels[2].usable = __builtin_cpu_supports("sse2");
+	memrev_kernels[3].usable = __builtin_cpu_supports("ssse3");
+	memrev_kernels[4].usable = __builtin_cpu_supports("avx2");
+	#endif
+
+	for (k=memrev_kernels;k->name;k++) {
+		if (!k->usable) continue;
+		memrev_best  = k->fn;
+		memswap_best = k->swap;
+	}
+
+	#ifdef USE_SIMD
+	if (memrev_kernels[2].usable) ascii_prefix = ascii_prefix_sse2;
+	if (memrev_kernels[4].usable) ascii_prefix = ascii_prefix_avx2;
+	#endif
+}
+
+/**
+ * Reverse a buffer in-place, with the fastest kernel available.
+ */
+char *memrev(char *buf, size_t len)
+{
+	if (!memrev_best) memrev_init();
+	memrev_best(buf, len);
+	return buf;
+}
+
+/**
+ * Reverse a string in-place
+ */
+char *strrev(char *str)
+{
+	return memrev(str, strlen(str));
+}
+
+/**
+ * One worker's share of memrev_parallel().
+ */
+struct memrev_job {
+	char  *buf;
+	size_t len;
+	size_t chunk;
+	size_t pairs;
+	int    index;
+	int    threads;
+	int    touch;
+};
+
+/**
+ * Swap each of this worker's chunk pairs. Chunk i from the front is
+ * paired with chunk i from the back, and the pairs are dealt out to the
+ * workers round-robin.
+ *
+ * With 'touch' set, we just fill the chunks instead, which lets the
+ * caller place the pages near the threads which will later use them.
+ */
+void *memrev_worker(void *arg)
+{
+	struct memrev_job *job = arg;
+	char *front, *back;
+	size_t p;
+
+	for (p=(size_t)job->index;p<job->pairs;p+=(size_t)job->threads) {
+		front = job->buf + p * job->chunk;
+		back  = job->buf + job->len - (p + 1) * job->chunk;
+
+		if (job->touch) {
+			memset(front, (int)(p & 0x7f), job->chunk);
+			memset(back,  (int)(p & 0x7f), job->chunk);
+		} else memswap_best(front, back, job->chunk);
+	}
+
+	return NULL;
+}
+
+/**
+ * Run the workers for memrev_parallel() / memtouch_parallel(). The
+ * calling thread takes care of the middle of the buffer, which is
+ * smaller than two chunks, then pitches in as the first worker.
+ */
+void memrev_run(char *buf, size_t len, int threads, size_t chunk, int touch)
+{
+	struct memrev_job jobs[MAX_THREADS];
+	size_t pairs, mid;
+	int i;
+	#ifdef USE_POSIX
+	pthread_t tids[MAX_THREADS];
+	#endif
+
+	if (!memrev_best)          memrev_init();
+	if (!chunk)                chunk   = PAR_CHUNK;
+	if (threads < 1)           threads = 1;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+	pairs = len / 2 / chunk;
+	mid   = pairs * chunk;
+	for (i=0;i<threads;i++) {
+		jobs[i].buf     = buf;
+		jobs[i].len     = len;
+		jobs[i].chunk   = chunk;
+		jobs[i].pairs   = pairs;
+		jobs[i].index   = i;
+		jobs[i].threads = threads;
+		jobs[i].touch   = touch;
+	}
+
+	#ifdef USE_POSIX
+	for (i=1;i<threads;i++) {
+		if (pthread_create(&tids[i], NULL, memrev_worker, &jobs[i]))
+			tids[i] = pthread_self();
+	}
+	#endif
+
+	if (touch) memset(buf + mid, 0, len - 2 * mid);
+	else       memrev_best(buf + mid, len - 2 * mid);
+	memrev_worker(&jobs[0]);
+
+	#ifdef USE_POSIX
+	for (i=1;i<threads;i++) {
+		if (pthread_equal(tids[i], pthread_self()))
+			memrev_worker(&jobs[i]);
+		else pthread_join(tids[i], NULL);
+	}
+	#else
+	for (i=1;i<threads;i++) memrev_worker(&jobs[i]);
+	#endif
+}
+
+/**
+ * Reverse a buffer in-place, with several threads
+ *
+ * A single core can't keep up with memory bandwidth, so for very large
+ * buffers, we split the buffer into mirrored pairs of chunks, and give
+ * each pair to a worker which swaps and reverses them in one go. Every
+ * byte is read and written exactly once, as with memrev().
+ *
+ * Without USE_POSIX, the workers simply run one after another.
+ */
+char *memrev_parallel(char *buf, size_t len, int threads, size_t chunk)
+{
+	memrev_run(buf, len, threads, chunk, 0);
+	return buf;
+}
+
+/**
+ * Fill a buffer with the same threads and chunks that memrev_parallel()
+ * would use.
+ *
+ * Pages are usually placed on the NUMA node of the thread that first
+ * touches them, so filling a new buffer this way keeps each chunk close
+ * to the thread that will reverse it.
+ */
+void memtouch_parallel(char *buf, size_t len, int threads, size_t chunk)
+{
+	memrev_run(buf, len, threads, chunk, 1);
+}
+
+/**
+ * Length of a UTF-8 sequence, given its first byte, or 0 if the byte
+ * can't start a sequence.
+ */
+int utf8_seq_len(unsigned char c)
+{
+	if (c < 0x80)           return 1;
+	if ((c & 0xe0) == 0xc0) return 2;
+	if ((c & 0xf0) == 0xe0) return 3;
+	if ((c & 0xf8) == 0xf0) return 4;
+	return 0;
+}
+
+/**
+ * Decode the code point at the start of a buffer.
+ *
+ * Returns the length of the sequence. Invalid or truncated sequences
+ * are treated as a single byte, with *cp set to the byte itself.
+ */
+int utf8_decode(const unsigned char *p, size_t len, unsigned long *cp)
+{
+	int i, n = utf8_seq_len(*p);
+
+	if (n < 2 || (size_t)n > len) {
+		*cp = *p;
+		return 1;
+	}
+
+	*cp = *p & (0x7f >> n);
+	for (i=1;i<n;i++) {
+		if ((p[i] & 0xc0) != 0x80) {
+			*cp = *p;
+			return 1;
+		}
+		*cp = (*cp << 6) | (p[i] & 0x3f);
+	}
+
+	return n;
+}
+
+/**
+ * Ranges of code points which extend the preceding grapheme cluster.
+ *
+ * This isn't the full Unicode Grapheme_Cluster_Break table, which
+ * would dwarf the rest of this program. It covers the combining marks
+ * of the major scripts, joiners, variation selectors, emoji modifiers
+ * and tags, which accounts for nearly all clusters in practice.
+ */
+unsigned long grapheme_extend[][2] = {
+	{ 0x0300, 0x036f }, { 0x0483, 0x0489 }, { 0x0591, 0x05bd },
+	{ 0x05bf, 0x05bf }, { 0x05c1, 0x05c2 }, { 0x05c4, 0x05c5 },
+	{ 0x05c7, 0x05c7 }, { 0x0610, 0x061a }, { 0x064b, 0x065f },
+	{ 0x0670, 0x0670 }, { 0x06d6, 0x06dc }, { 0x06df, 0x06e4 },
+	{ 0x06e7, 0x06e8 }, { 0x06ea, 0x06ed }, { 0x0900, 0x0903 },
+	{ 0x093a, 0x093c }, { 0x093e, 0x094f }, { 0x0951, 0x0957 },
+	{ 0x0962, 0x0963 }, { 0x0e31, 0x0e31 }, { 0x0e34, 0x0e3a },
+	{ 0x0e47, 0x0e4e }, { 0x1ab0, 0x1aff }, { 0x1dc0, 0x1dff },
+	{ 0x200c, 0x200d }, { 0x20d0, 0x20ff }, { 0x302a, 0x302f },
+	{ 0x3099, 0x309a }, { 0xfe00, 0xfe0f }, { 0xfe20, 0xfe2f },
+	{ 0x1f3fb, 0x1f3ff }, { 0xe0020, 0xe007f }, { 0xe0100, 0xe01ef }
+};
+
+/**
+ * Check whether a code point extends the preceding grapheme cluster.
+ */
+int is_grapheme_extend(unsigned long cp)
+{
+	unsigned int lo = 0, mid;
+	unsigned int hi = sizeof(grapheme_extend) / sizeof(grapheme_extend[0]);
+
+	if (cp < 0x0300) return 0;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cp < grapheme_extend[mid][0])      hi = mid;
+		else if (cp > grapheme_extend[mid][1]) lo = mid + 1;
+		else return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Lead bytes which can start an extending code point, filled in by
+ * extend_lead_init(). This lets us skip decoding most code points.
+ */
+unsigned char extend_lead[256];
+
+/**
+ * Fill in extend_lead[] from grapheme_extend[].
+ */
+void extend_lead_init(void)
+{
+	unsigned long cp; unsigned int i;
+
+	for (i=0;i<sizeof(grapheme_extend)/sizeof(grapheme_extend[0]);i++) {
+		for (cp=grapheme_extend[i][0];cp<=grapheme_extend[i][1];cp++) {
+			if (cp < 0x800)        extend_lead[0xc0 | (cp >> 6)]  = 1;
+			else if (cp < 0x10000) extend_lead[0xe0 | (cp >> 12)] = 1;
+			else                   extend_lead[0xf0 | (cp >> 18)] = 1;
+		}
+	}
+}
+
+/* Regional indicators, which form flags in pairs */
+#define IS_REGIONAL(X) ((X) >= 0x1f1e6 && (X) <= 0x1f1ff)
+
+/**
+ * Length, in bytes, of the grapheme cluster at the start of a buffer.
+ *
+ * A cluster is a code point followed by any extending code points. A
+ * zero-width joiner also joins the code point after it (as in emoji
+ * sequences), and regional indicators pair up into flags.
+ */
+size_t utf8_cluster_len(const unsigned char *p, size_t len)
+{
+	unsigned long cp, prev;
+	size_t n, i;
+
+	i = (size_t)utf8_decode(p, len, &prev);
+	while (i < len) {
+		if (!extend_lead[p[i]] && prev != 0x200d && !IS_REGIONAL(prev))
+			break;
+
+		n = (size_t)utf8_decode(p + i, len - i, &cp);
+		if (!is_grapheme_extend(cp) && prev != 0x200d &&
+		    !(IS_REGIONAL(prev) && IS_REGIONAL(cp) && i <= 4))
+			break;
+		i   += n;
+		prev = cp;
+	}
+
+	return i;
+}
+
+/**
+ * Reverse a UTF-8 buffer in-place, by code point or grapheme cluster
+ *
+ * Reversing the bytes turns each multi-byte sequence around, so that
+ * its continuation bytes come before its lead byte. By code point, we
+ * simply reverse the bytes, then make a second pass over the buffer
+ * turning each such sequence back around. ASCII bytes don't need
+ * fixing, so runs of them are skipped with the fastest ascii_prefix()
+ * kernel. Invalid sequences are left byte-reversed.
+ *
+ * Grapheme clusters are far easier to find in the original text than
+ * in the reversed text, so for those the fix-up pass comes first: we
+ * reverse the bytes of each cluster in place, so that reversing the
+ * whole buffer afterward puts them back in order.
+ */
+char *utf8rev(char *buf, size_t len, int graphemes)
+{
+	unsigned char *p = (unsigned char *)buf, *end = p + len, *q, *r, c;
+	size_t n;
+
+	if (!memrev_best) memrev_init();
+	if (graphemes) {
+		if (!extend_lead[0xcc]) extend_lead_init();
+		while (p < end) {
+			/* The last ASCII byte may be the start of a cluster */
+			if (*p < 0x80 && (n = ascii_prefix((char *)p,
+			                                   (size_t)(end - p))) > 1)
+				p += n - 1;
+
+			n = utf8_cluster_len(p, (size_t)(end - p));
+			for (q=p,r=p+n-1;q<r;q++,r--) { c = *q; *q = *r; *r = c; }
+			p += n;
+		}
+
+		memrev_best(buf, len);
+		return buf;
+	}
+
+	memrev_best(buf, len);
+	while (p < end) {
+		if (*p < 0x80) {
+			p += ascii_prefix((char *)p, (size_t)(end - p));
+			continue;
+		}
+
+		/* Count the continuation bytes before the lead byte */
+		for (n=0;n<(size_t)(end - p) && n < 4 && (p[n] & 0xc0) == 0x80;n++);
+		if (!n || n == (size_t)(end - p) || utf8_seq_len(p[n]) != (int)n + 1) {
+			p += n ? n : 1;
+			continue;
+		}
+
+		/* Turn the sequence back around */
+		c = p[0]; p[0] = p[n]; p[n] = c;
+		if (n == 3) { c = p[1]; p[1] = p[2]; p[2] = c; }
+		p += n + 1;
+	}
+
+	return buf;
+}
+
+/**
+ * Get the current time in seconds, for benchmarking.
+ */
+double bench_now(void)
+{
+	#ifdef USE_POSIX
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+	#else
+	return (double)clock() / CLOCKS_PER_SEC;
+	#endif
+}
+
+#ifdef USE_POSIX
+/**
+ * Reverse each line of a buffer in-place.
+ */
+void reverse_lines(char *buf, size_t len)
+{
+	char *end = buf + len, *nl;
+
+	while (buf < end) {
+		if (!(nl = memchr(buf, '\n', (size_t)(end - buf)))) nl = end;
+		memrev_best(buf, (size_t)(nl - buf));
+		buf = nl + 1;
+	}
+}
+
+/**
+ * Reverse a file in-place, by byte or by line
+ *
+ * The file is mapped into memory, rather than read into the heap, so
+ * the size of the file is limited only by the address space. The
+ * kernel pages it in (and writes it back) as we go, while the SIMD
+ * kernel swaps blocks from either end.
+ *
+ * By line, we reverse the bytes and then reverse each line again, which
+ * puts the lines in reverse order. A newline at the end of the file
+ * stays there.
+ *
+ * Returns 0 on success, with the file's size in *size, or -1 on error.
+ */
+int reverse_file(const char *path, int lines, off_t *size)
+{
+	struct stat st;
+	size_t len;
+	char *map;
+	int fd;
+
+	if ((fd = open(path, O_RDWR)) < 0 || fstat(fd, &st)) {
+		perror(path);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	*size = st.st_size;
+	if (!st.st_size) {
+		close(fd);
+		return 0;
+	}
+
+	if ((off_t)(size_t)st.st_size != st.st_size) {
+		fprintf(stderr, "%s: Too large to map into memory\n", path);
+		close(fd);
+		return -1;
+	}
+
+	len = (size_t)st.st_size;
+	if ((map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                fd, 0)) == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+
+	if (!memrev_best) memrev_init();
+	if (lines && map[len - 1] == '\n') len--;
+	memrev_best(map, len);
+	if (lines) reverse_lines(map, len);
+
+	munmap(map, (size_t)st.st_size);
+	close(fd);
+	return 0;
+}
+
+/**
+ * Copy the bytes [start, end) of a file to stdout, a block at a time,
+ * through buf. Returns -1 if a read fails.
+ */
+int copy_range(int fd, off_t start, off_t end, char *buf)
+{
+	size_t n;
+
+	for (;start<end;start+=(off_t)n) {
+		n = (size_t)(end - start < (off_t)STREAM_BLOCK ? end - start :
+		             (off_t)STREAM_BLOCK);
+		if (pread(fd, buf, n, start) != (ssize_t)n) {
+			perror("pread");
+			return -1;
+		}
+		fwrite(buf, 1, n, stdout);
+	}
+
+	return 0;
+}
+
+/**
+ * Write the reverse of a file to stdout, by byte or by line
+ *
+ * Here, we read fixed-size blocks from the end of the file toward the
+ * beginning with pread(), so that only one block (plus one partial
+ * line, when going by line) is in memory at a time.
+ *
+ * By line, the part of a line which started in an earlier block is
+ * kept after the next block, until we find where it starts. A line
+ * longer than a block isn't kept: we only remember where it ends, and
+ * once we find where it starts, read it again, front to back.
+ *
+ * Returns 0 on success, with the file's size in *size, or -1 on error.
+ */
+int stream_file(const char *path, int lines, off_t *size)
+{
+	size_t carry = 0, n, end;
+	off_t pos, spill = -1;
+	int fd, trail = 0, err = 0;
+	struct stat st;
+	char *buf;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st)) {
+		perror(path);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	/* A block and a partial line, then a block for copy_range() */
+	if (!(buf = malloc(3 * STREAM_BLOCK))) {
+		fprintf(stderr, "Unable to allocate %lu bytes!\n",
+		        (unsigned long)(3 * STREAM_BLOCK));
+		close(fd);
+		return -1;
+	}
+
+	/* A newline at the end of the file stays there */
+	pos = *size = st.st_size;
+	if (lines && pos && pread(fd, buf, 1, pos - 1) == 1 && *buf == '\n') {
+		trail = 1;
+		pos--;
+	}
+
+	if (!memrev_best) memrev_init();
+	while (pos > 0) {
+		n    = (size_t)(pos < (off_t)STREAM_BLOCK ? pos : (off_t)STREAM_BLOCK);
+		pos -= (off_t)n;
+
+		/* The block goes before the partial line */
+		memmove(buf + n, buf, carry);
+		if (pread(fd, buf, n, pos) != (ssize_t)n) {
+			perror("pread");
+			err = 1;
+			break;
+		}
+
+		if (!lines) {
+			memrev_best(buf, n);
+			fwrite(buf, 1, n, stdout);
+			continue;
+		}
+
+		/* Find where a long line starts, and write it */
+		end = n + carry;
+		if (spill >= 0) {
+			while (n > 0 && buf[n - 1] != '\n') n--;
+			if (!n) continue;
+
+			if (copy_range(fd, pos + (off_t)n, spill, buf + 2 * STREAM_BLOCK)) {
+				err = 1;
+				break;
+			}
+			putchar('\n');
+			spill = -1;
+			end   = --n;
+		}
+
+		/* Write out each complete line, last one first */
+		for (;n>0;n--) {
+			if (buf[n - 1] != '\n') continue;
+			fwrite(buf + n, 1, end - n, stdout);
+			putchar('\n');
+			end = n - 1;
+		}
+
+		/* Don't keep a partial line longer than a block */
+		if (end > STREAM_BLOCK) {
+			spill = pos + (off_t)end;
+			end   = 0;
+		}
+
+		carry = end;
+	}
+
+	/* The first line in the file */
+	if (lines && !err) {
+		if (spill >= 0) err = copy_range(fd, 0, spill, buf + 2 * STREAM_BLOCK);
+		else fwrite(buf, 1, carry, stdout);
+		if (trail && !err) putchar('\n');
+	}
+
+	free(buf);
+	close(fd);
+	return err ? -1 : 0;
+}
+#endif /* USE_POSIX */
+
+/**
+ * Benchmark each usable kernel, for buffer sizes from 16 bytes up to
+ * max_len, growing by a factor of 4 each step (so that the default
+ * lands on 1 GiB), and ending with max_len itself. Each size is
+ * reversed enough times to process about BENCH_BYTES in total.
+ */
+void benchmark(size_t max_len)
+{
+	struct memrev_kernel *k;
+	unsigned long i, iters;
+	size_t len, next;
+	double t;
+	char *buf;
+
+	if (!memrev_best) memrev_init();
+	if (!(buf = malloc(max_len))) {
+		fprintf(stderr, "Unable to allocate %lu bytes!\n",
+		        (unsigned long)max_len);
+		exit(EXIT_FAILURE);
+	}
+
+	for (len=0;len<max_len;len++) buf[len] = (char)('a' + len % 26);
+	printf("%-6s %12s %9s %9s\n", "Kernel", "Size", "Time (s)", "GB/s");
+	for (len=max_len<16?max_len:16;len;len=next) {
+		iters = BENCH_BYTES / len;
+		if (!iters) iters = 1;
+
+		for (k=memrev_kernels;k->name;k++) {
+			if (!k->usable) continue;
+
+			t = bench_now();
+			for (i=0;i<iters;i++) k->fn(buf, len);
+			t = bench_now() - t;
+
+			printf("%-6s %12lu %9.6f %9.3f\n", k->name,
+			       (unsigned long)len, t,
+			       t > 0 ? (double)len * iters / t / 1e9 : 0.0);
+		}
+
+		next = len == max_len ? 0 : len > max_len / 4 ? max_len : len * 4;
+	}
+
+	free(buf);
+}
+
+/**
+ * Benchmark memrev_parallel() from 1 thread up to max_threads, doubling
+ * each step, against the single-threaded kernel. The buffer is filled
+ * with memtouch_parallel() first, using max_threads.
+ */
+void benchmark_parallel(size_t len, size_t chunk, int max_threads)
+{
+	double t, base = 0;
+	int i, threads;
+	char *buf;
+
+	if (!memrev_best) memrev_init();
+	if (!len || !(buf = malloc(len))) {
+		fprintf(stderr, "Unable to allocate %lu bytes!\n",
+		        (unsigned long)len);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!chunk) chunk = PAR_CHUNK;
+	memtouch_parallel(buf, len, max_threads, chunk);
+
+	printf("%-7s %12s %9s %9s %7s\n",
+	       "Threads", "Chunk", "Time (s)", "GB/s", "Speedup");
+	for (threads=0;threads<=max_threads;threads=threads ? threads*2 : 1) {
+		if (threads > 1 && threads * 2 > max_threads)
+			threads = max_threads;
+
+		t = bench_now();
+		for (i=0;i<4;i++) {
+			if (threads) memrev_parallel(buf, len, threads, chunk);
+			else         memrev(buf, len);
+		}
+		t = bench_now() - t;
+		if (!threads) base = t;
+
+		if (threads) printf("%-7d %12lu", threads, (unsigned long)chunk);
+		else         printf("%-7s %12s", "simd", "-");
+		printf(" %9.6f %9.3f %7.2f\n", t,
+		       t > 0 ? (double)len * 4 / t / 1e9 : 0.0, t > 0 ? base / t : 0.0);
+		if (threads == max_threads) break;
+	}
+
+	free(buf);
+}
+
+/**
+ * Sample text for the UTF-8 benchmark, in a few different scripts.
+ */
+const char *utf8_corpora[][2] = {
+	{ "ascii", "The quick brown fox jumps over the lazy dog. " },
+	{ "latin", "Le c\xc5\x93ur d\xc3\xa9\xc3\xa7u mais l'\xc3\xa2me plut"
+	           "\xc3\xb4t na\xc3\xafve, Lou\xc3\xbfs r\xc3\xaava de crapa"
+	           "\xc3\xbcter. " },
+	{ "cyrillic", "\xd0\xa1\xd1\x8a\xd0\xb5\xd1\x88\xd1\x8c \xd0\xb6\xd0"
+	              "\xb5 \xd0\xb5\xd1\x89\xd1\x91 \xd1\x8d\xd1\x82\xd0\xb8"
+	              "\xd1\x85 \xd0\xbc\xd1\x8f\xd0\xb3\xd0\xba\xd0\xb8\xd1"
+	              "\x85 \xd0\xb1\xd1\x83\xd0\xbb\xd0\xbe\xd0\xba, \xd0\xb4"
+	              "\xd0\xb0 \xd1\x87\xd0\xb0\xd1\x8e. " },
+	{ "cjk", "\xe6\x88\x91\xe8\x83\xbd\xe5\x90\x9e\xe4\xb8\x8b\xe7\x8e\xbb"
+	         "\xe7\x92\x83\xe8\x80\x8c\xe4\xb8\x8d\xe4\xbc\xa4\xe8\xba\xab"
+	         "\xe4\xbd\x93\xe3\x80\x82" },
+	{ "emoji", "\xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd \xf0\x9f\x91\xa8\xe2\x80"
+	           "\x8d\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x91\xa7 \xf0\x9f"
+	           "\x87\xb3\xf0\x9f\x87\xb1 e\xcc\x81 " },
+	{ "mixed", "Hello, \xd0\xbc\xd0\xb8\xd1\x80! \xe4\xbd\xa0\xe5\xa5\xbd"
+	           " caf\xc3\xa9 \xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd ok. " },
+	{ NULL, NULL }
+};
+
+/**
+ * Benchmark reversing each sample corpus, repeated to fill a buffer
+ * of len bytes, by byte, by code point and by grapheme cluster.
+ *
+ * The buffer is refilled before each mode, as an odd number of byte
+ * reversals would leave it as invalid UTF-8. Only whole copies of the
+ * corpus are used, padded out with spaces, so no character is cut.
+ */
+void benchmark_utf8(size_t len)
+{
+	const char *modes[] = { "bytes", "codepoints", "graphemes" };
+	unsigned long i, iters;
+	size_t n, slen;
+	int c, m;
+	double t;
+	char *buf;
+
+	if (!memrev_best) memrev_init();
+	if (!len || !(buf = malloc(len))) {
+		fprintf(stderr, "Unable to allocate %lu bytes!\n",
+		        (unsigned long)len);
+		exit(EXIT_FAILURE);
+	}
+
+	iters = BENCH_BYTES / len;
+	if (!iters) iters = 1;
+
+	printf("%-8s %-10s %9s %9s\n", "Corpus", "Mode", "Time (s)", "GB/s");
+	for (c=0;utf8_corpora[c][0];c++) {
+		slen = strlen(utf8_corpora[c][1]);
+		for (m=0;m<3;m++) {
+			for (n=0;len-n>=slen;n+=slen)
+				memcpy(buf + n, utf8_corpora[c][1], slen);
+			memset(buf + n, ' ', len - n);
+
+			t = bench_now();
+			for (i=0;i<iters;i++) {
+				if (!m) memrev(buf, len);
+				else    utf8rev(buf, len, m - 1);
+			}
+			t = bench_now() - t;
+
+			printf("%-8s %-10s %9.6f %9.3f\n", utf8_corpora[c][0],
+			       modes[m], t, t > 0 ? (double)len * iters / t / 1e9 : 0.0);
+		}
+	}
+
+	free(buf);
 }
 
 int main(int argc, char *argv[])
 {
 	/* Check arguments */
 	if (argc < 2 || !argv[1]) {
-		printf("%s <string>\n", argv[0]);
+		printf("%s [-u|-g] <string>\n", argv[0]);
+		printf("%s -b|-bu [size]\n", argv[0]);
 		printf("Reverse a string in place\n");
 		printf("\tstring: string to reverse\n");
+		printf("\t-u:     reverse UTF-8 code points, rather than bytes\n");
+		printf("\t-g:     reverse UTF-8 grapheme clusters\n");
+		#ifdef USE_POSIX
+		printf("%s -f|-fl|-s|-sl <file>\n", argv[0]);
+		printf("\t-f:     reverse a file in place (-fl: by line)\n");
+		printf("\t-s:     write a file to stdout reversed (-sl: by line)\n");
+		#endif
+		printf("\t-b:     benchmark each kernel, up to size bytes "
+		       "(default: 1 GiB)\n");
+		printf("\t-bu:    benchmark the UTF-8 modes, on size bytes "
+		       "(default: 64 MiB)\n");
+		printf("%s -bp [size [chunk [threads]]]\n", argv[0]);
+		printf("\t-bp:    benchmark the multi-threaded variant, on size "
+		       "bytes (default: 512 MiB)\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (!strcmp(argv[1], "-b")) {
+		if (argc > 2) benchmark((size_t)strtoul(argv[2], NULL, 10));
+		else if ((size_t)-1 < BENCH_BYTES) benchmark((size_t)-1);
+		else benchmark((size_t)BENCH_BYTES);
+		return 0;
+	}
+
+	if (!strcmp(argv[1], "-bp")) {
+		int threads = 1;
+		#ifdef USE_POSIX
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		#endif
+
+		if (argc > 4) threads = atoi(argv[4]);
+		benchmark_parallel(argc > 2 ? (size_t)strtoul(argv[2], NULL, 10)
+		                            : (size_t)(BENCH_BYTES >> 1),
+		                   argc > 3 ? (size_t)strtoul(argv[3], NULL, 10)
+		                            : (size_t)PAR_CHUNK,
+		                   threads < 1 ? 1 : threads);
+		return 0;
+	}
+
+	if (!strcmp(argv[1], "-bu")) {
+		if (argc > 2) benchmark_utf8((size_t)strtoul(argv[2], NULL, 10));
+		else if ((size_t)-1 < BENCH_BYTES) benchmark_utf8((size_t)-1 >> 4);
+		else benchmark_utf8((size_t)(BENCH_BYTES >> 4));
+		return 0;
+	}
+
+	#ifdef USE_POSIX
+	if (argv[1][0] == '-' && (argv[1][1] == 'f' || argv[1][1] == 's') &&
+	    (!argv[1][2] || (argv[1][2] == 'l' && !argv[1][3])) && argc > 2) {
+		off_t size = 0;
+		double t = bench_now();
+
+		if ((argv[1][1] == 'f' ? reverse_file : stream_file)
+		    (argv[2], argv[1][2] == 'l', &size))
+			exit(EXIT_FAILURE);
+
+		fflush(stdout);
+		t = bench_now() - t;
+		fprintf(stderr, "Reversed %.0f bytes in %.6f s (%.3f GB/s)\n",
+		        (double)size, t, t > 0 ? (double)size / t / 1e9 : 0.0);
+		return 0;
+	}
+	#endif
+
 	/* Do it */
+	if ((!strcmp(argv[1], "-u") || !strcmp(argv[1], "-g")) && argc > 2) {
+		printf("Reversing: %s\n", argv[2]);
+		printf("Result:    %s\n", utf8rev(argv[2], strlen(argv[2]),
+		                                   argv[1][1] == 'g'));
+		return 0;
+	}
+
 	printf("Reversing: %s\n", argv[1]);
 	printf("Result:    %s\n", strrev(argv[1]));
 	return 0;
 }
-
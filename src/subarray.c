@@ -6,6 +6,10 @@
  * See the LICENSE file for details.
  *
  * Compiling: gcc -ansi -pedantic -Wall -W -O2 -o subarray subarray.c
+ * Defines:
+ *     USE_C:     Don't use the AVX2 kernel.
+ *     USE_POSIX: Use clock_gettime() for the benchmark timer, threads for
+ *                max_subarray_parallel(), and memory-map streamed files.
  *
  * Running:
  *     O(n^2) algorithm:
@@ -17,154 +21,1542 @@
  *
  *     tim@cid ~ $ ./subarray 1 -1 2 5 -1 3 -2 1
  *     The maximum sub-array is: [ 2, 5, -1, 3 ] with sum: 9
+ *
+ *     tim@cid ~ $ ./subarray -b
+ *     Kernel    Time (s)     GB/s  ns/number ...
+ *
+ *     tim@cid ~ $ ./subarray -bt 100000000 8
+ *     Threads   Time (s)     GB/s  Speedup ...
+ *
+ *     tim@cid ~ $ ./subarray -bq
+ *     Operation           Count   Time (s)          Ops/s ...
+ *
+ *     With a length from 2 to 3, and of a 2 x 3 matrix:
+ *
+ *     tim@cid ~ $ ./subarray -w 2 3 -1 2 5 -1 3 -2 1
+ *     The maximum sub-array is: [ 2, 5 ] with sum: 7
+ *
+ *     tim@cid ~ $ ./subarray -m 2 3 1 -2 3 -4 5 6
+ *     The maximum sub-matrix is: rows [ 0, 2 ), columns [ 1, 3 ) with sum: 12
+ *
+ *     tim@cid ~ $ ./subarray -b2 4096 8
+ *     Threads   Time (s)   Gcells/s  Speedup ...
+ *
+ *     Streaming 64-bit numbers from a file, or newline-delimited text
+ *     from a pipe:
+ *
+ *     tim@cid ~ $ ./subarray -s numbers.bin
+ *     tim@cid ~ $ seq -5 5 | ./subarray -st
+ *     The maximum sub-array is: [ 5, 11 ) with sum: 15
  */
+#ifdef USE_POSIX
+#define _XOPEN_SOURCE 600
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#ifdef USE_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Number of elements for the benchmark */
+#define BENCH_COUNT 100000000L
+
+/* Number of elements, and of queries, for the segment tree benchmark */
+#define TREE_COUNT   0x100000
+#define TREE_QUERIES 1000000L
+
+/* Most threads for max_subarray_parallel() */
+#define MAX_THREADS 64
 
 /**
- * A struct to keep track of the current max. subarray.
+ * max_submatrix() works on this many tops at once, so each row it reads
+ * is used for all of them, and on this many columns at a time, so their
+ * column sums stay in cache.
  */
-struct sub_array {
-	unsigned int start;
-	unsigned int end;
-	long sum;
-};
+#define BLOCK_ROWS 8
+#define BLOCK_COLS 512
+
+/* Size of the matrix for the submatrix benchmark */
+#define MATRIX_SIZE 4096
+
+/* Bytes read at a time when streaming, and numbers parsed at a time */
+#if UINT_MAX <= 0xffffU
+#define STREAM_CHUNK 0x1000
+#else
+#define STREAM_CHUNK 0x10000
+#endif
+#define TEXT_BATCH   256
 
 /**
- * Compute the sum of a subarray.
- *
- * array: Pointer to the start of the subarray
- * length: Length of the subarray
+ * The AVX2 kernel needs 64-bit longs, and per-function target
+ * attributes, so that it can be picked at runtime.
  */
-long sum_array(long *array, unsigned int length)
-{
-	long sum = 0; unsigned int i;
-	for (i=0;i<length;i++) sum += array[i];
-	return sum;
-}
+#if !defined(USE_C) && defined(__x86_64__) && ULONG_MAX > 0xffffffffUL && \
+    (defined(__clang__) || __GNUC__ >= 5)
+#define USE_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * A struct to keep track of the current max. subarray: the elements
+ * [start, end), and their sum.
+ */
+struct sub_array {
+	size_t start;
+	size_t end;
+	long sum;
+};
 
 /**
- * Find the maximum subarray by linearly searching over the array,
- * from each end, for each possible subarray length.
+ * Find the maximum subarray by trying every start, and every end for
+ * each start, keeping a running sum.
  *
  * For me, this was the solution which came the easiest. It's also
  * quite naieve.
  *
  * This is runs in O(n^2) time, and O(1) space.
  */
-struct sub_array *find_max_subarray(long *array, unsigned int size)
+struct sub_array find_max_subarray(const long *array, size_t size)
 {
-	struct sub_array *max_subarray;
-	unsigned int sa_len;
+	struct sub_array max_subarray = { 0, 0, 0 };
+	size_t start, end;
+	long sum;
 
-	if (!(max_subarray = calloc(1, sizeof(struct sub_array)))) {
-		fprintf(stderr, "find_max_subarray: Out of memory!\n");
-		exit(EXIT_FAILURE);
+	for (start=0;start<size;start++) {
+		for (sum=0,end=start;end<size;end++) {
+			sum += array[end];
+
+			/* On a tie, the one ending first, then the longest, as Kadane's */
+			if (!max_subarray.end || sum > max_subarray.sum ||
+			    (sum == max_subarray.sum && end + 1 < max_subarray.end)) {
+				max_subarray.start = start;
+				max_subarray.end   = end + 1;
+				max_subarray.sum   = sum;
+			}
+		}
 	}
 
-	for (sa_len=2;sa_len<size;sa_len++) {
-		unsigned int start = 0, end = size - 1;
+	return max_subarray;
+}
 
-		do {
-			long sum1 = sum_array(array + start, sa_len);
-			long sum2 = sum_array(array + end - sa_len, sa_len);
+/**
+ * The state of Kadane's algorithm between chunks of a stream: how many
+ * elements it's seen, the sum of the best subarray ending at the last
+ * one, where that starts, and the best subarray so far.
+ */
+struct kadane_state {
+	size_t count;
+	size_t start;
+	long current;
+	struct sub_array best;
+};
 
-			if (sum1 > max_subarray->sum) {
-				max_subarray->start = start;
-				max_subarray->end   = start + sa_len;
-				max_subarray->sum   = sum1;
-			}
+void kadane_init(struct kadane_state *k)
+{
+	memset(k, 0, sizeof(*k));
+}
 
-			if (sum2 > max_subarray->sum) {
-				max_subarray->start = end - sa_len;
-				max_subarray->end   = end;
-				max_subarray->sum   = sum2;
-			}
+/**
+ * Feed the next size elements of the stream to Kadane's algorithm. Any
+ * number of chunks, of any size, give the same result as one.
+ */
+void kadane_feed(struct kadane_state *k, const long *array, size_t size)
+{
+	struct sub_array max_subarray = k->best;
+	size_t i = 0, s = k->start, base = k->count;
+	long current_max = k->current;
 
-			start++; end--;
-		} while (start <= (size >> 1)  && end > (size >> 1) &&
-		         start < size - sa_len && end > sa_len);
+	if (!size) return;
+	if (!base) {
+		max_subarray.start = 0;
+		max_subarray.end   = 1;
+		max_subarray.sum   = current_max = array[0];
+		i = 1;
 	}
 
-	return max_subarray;
+	/**
+	 * Iterate over the array, figuring the maximum subarray as a
+	 * running sum.
+	 */
+	for (;i<size;i++) {
+		if (current_max < 0) {
+			current_max = array[i];
+			s = base + i;
+		} else current_max += array[i];
+
+		if (current_max > max_subarray.sum) {
+			max_subarray.start = s;
+			max_subarray.end   = base + i + 1;
+			max_subarray.sum   = current_max;
+		}
+	}
+
+	k->count   = base + size;
+	k->start   = s;
+	k->current = current_max;
+	k->best    = max_subarray;
 }
 
 /**
  * An implementation of Kadane's Algorithm for solving this problem.
  *
+ * The subarray is never empty (unless the array is), so for an array of
+ * negative numbers, it's the largest one. If several subarrays have the
+ * largest sum, the one which ends first is returned, and of those, the
+ * longest.
+ *
  * This runs in O(n) time, and O(1) space.
  */
-struct sub_array *max_subarray_kadane(long *array, unsigned int size)
+struct sub_array max_subarray_kadane(const long *array, size_t size)
 {
-	unsigned int i,s = 0; long current_max = array[0];
-	struct sub_array *max_subarray;
+	struct kadane_state k;
 
-	if (!(max_subarray = calloc(1, sizeof(struct sub_array)))) {
-		fprintf(stderr, "max_subarray_kadane: Out of memory!\n");
-		exit(EXIT_FAILURE);
+	kadane_init(&k);
+	kadane_feed(&k, array, size);
+	return k.best;
+}
+
+/**
+ * A summary of the segment [start, end) of an array, from which the
+ * maximum subarray of two adjacent segments can be found without
+ * looking at their elements again: the sum of the segment, and the best
+ * subarrays which start at its start, which end at its end, and which
+ * are anywhere in it. Ties are broken as Kadane's algorithm does.
+ */
+struct segment_summary {
+	long total;
+	struct sub_array prefix;
+	struct sub_array suffix;
+	struct sub_array best;
+};
+
+/**
+ * Summarize a (non-empty) segment, in one pass. This works with prefix
+ * sums: the best subarray ending at i is the sum of the elements up to
+ * i, less the smallest sum of the elements before some k <= i, and it
+ * then starts at k.
+ */
+struct segment_summary summarize(const long *array, size_t start,
+                                 size_t end)
+{
+	struct segment_summary s;
+	size_t i, at = start;
+	long sum = 0, min = 0, c;
+
+	memset(&s, 0, sizeof(s));
+	for (i=start;i<end;i++) {
+		if (sum < min) {
+			min = sum;
+			at  = i;
+		}
+
+		sum += array[i];
+		c    = sum - min;
+		if (i == start || c > s.best.sum) {
+			s.best.start = at;
+			s.best.end   = i + 1;
+			s.best.sum   = c;
+		}
+
+		if (i == start || sum > s.prefix.sum) {
+			s.prefix.end = i + 1;
+			s.prefix.sum = sum;
+		}
+	}
+
+	s.total        = sum;
+	s.prefix.start = start;
+	s.suffix.start = at;
+	s.suffix.end   = end;
+	s.suffix.sum   = sum - min;
+	return s;
+}
+
+/**
+ * Combine the summaries of two adjacent segments, x then y. This is
+ * associative, so segments can be combined in any grouping.
+ */
+struct segment_summary merge_summaries(struct segment_summary x,
+                                       struct segment_summary y)
+{
+	struct segment_summary m;
+	long cross = x.suffix.sum + y.prefix.sum;
+
+	m.total  = x.total + y.total;
+	m.prefix = x.prefix;
+	if (x.total + y.prefix.sum > x.prefix.sum) {
+		m.prefix.end = y.prefix.end;
+		m.prefix.sum = x.total + y.prefix.sum;
+	}
+
+	/* The longest suffix wins a tie */
+	m.suffix = y.suffix;
+	if (x.suffix.sum + y.total >= y.suffix.sum) {
+		m.suffix.start = x.suffix.start;
+		m.suffix.sum   = x.suffix.sum + y.total;
 	}
 
 	/**
-	 * Iterate over the array, figuring the maximum subarray as a
-	 * running sum.
+	 * The best is in x, or crosses into y, or is in y. The one which
+	 * ends first wins a tie, and then the longest.
 	 */
-	for (i=1;i<size;i++) {
-		if (current_max < 0) {
-			current_max = array[i];
-			s = i;
-		} else current_max += array[i];
+	m.best = y.best;
+	if (cross > y.best.sum ||
+	    (cross == y.best.sum && y.prefix.end <= y.best.end)) {
+		m.best.start = x.suffix.start;
+		m.best.end   = y.prefix.end;
+		m.best.sum   = cross;
+	}
+
+	if (x.best.sum >= m.best.sum) m.best = x.best;
+	return m;
+}
+
+#ifdef USE_SIMD
+/**
+ * One step of summarize(), in each lane.
+ */
+#define SUMMARY_STEP(x)                                   \
+	do {                                                  \
+		k      = _mm256_cmpgt_epi64(min, sum);            \
+		min    = _mm256_blendv_epi8(min, sum, k);         \
+		at     = _mm256_blendv_epi8(at, idx, k);          \
+		sum    = _mm256_add_epi64(sum, x);                \
+		idx    = _mm256_add_epi64(idx, one);              \
+		c      = _mm256_sub_epi64(sum, min);              \
+		k      = _mm256_cmpgt_epi64(c, best);             \
+		best   = _mm256_blendv_epi8(best, c, k);          \
+		bstart = _mm256_blendv_epi8(bstart, at, k);       \
+		bend   = _mm256_blendv_epi8(bend, idx, k);        \
+		k      = _mm256_cmpgt_epi64(sum, pre);            \
+		pre    = _mm256_blendv_epi8(pre, sum, k);         \
+		pend   = _mm256_blendv_epi8(pend, idx, k);        \
+	} while (0)
+
+/**
+ * Summarize the segment [start, end) as summarize() does, by splitting
+ * it into 4 equal parts, and summarizing them all at once, one in each
+ * lane, combining them (and whatever is left over) at the end. Each
+ * step loads 4 elements from each part, and transposes them, so that
+ * lane l sees the elements of part l.
+ *
+ * This keeps the lanes independent, so there are no shuffles between
+ * them in the loop, only the compare and blends of summarize(). The
+ * sums of the elements of each segment must fit in a long.
+ */
+__attribute__((target("avx2")))
+struct segment_summary summarize_avx2(const long *array, size_t start,
+                                      size_t end)
+{
+	struct segment_summary s, seg;
+	const __m256i one = _mm256_set1_epi64x(1);
+	__m256i sum, min, at, best, bstart, bend, pre, pend, idx, k, c;
+	__m256i x0, x1, x2, x3, t0, t1, t2, t3;
+	long v[8][4];
+	size_t q = (end - start) / 16 * 4, i;
+	int l;
+
+	if (end - start < 16) return summarize(array, start, end);
+
+	array += start;
+	idx    = _mm256_set_epi64x((long)(start + 3 * q), (long)(start + 2 * q),
+	                           (long)(start + q), (long)start);
+	at     = idx;
+	sum    = min = bstart = bend = pend = _mm256_setzero_si256();
+	best   = pre = _mm256_set1_epi64x(LONG_MIN);
+
+	for (i=0;i<q;i+=4) {
+		x0 = _mm256_loadu_si256((const __m256i *)(array + i));
+		x1 = _mm256_loadu_si256((const __m256i *)(array + q + i));
+		x2 = _mm256_loadu_si256((const __m256i *)(array + 2 * q + i));
+		x3 = _mm256_loadu_si256((const __m256i *)(array + 3 * q + i));
+
+		t0 = _mm256_unpacklo_epi64(x0, x1);
+		t1 = _mm256_unpackhi_epi64(x0, x1);
+		t2 = _mm256_unpacklo_epi64(x2, x3);
+		t3 = _mm256_unpackhi_epi64(x2, x3);
+		x0 = _mm256_permute2x128_si256(t0, t2, 0x20);
+		x1 = _mm256_permute2x128_si256(t1, t3, 0x20);
+		x2 = _mm256_permute2x128_si256(t0, t2, 0x31);
+		x3 = _mm256_permute2x128_si256(t1, t3, 0x31);
+
+		SUMMARY_STEP(x0);
+		SUMMARY_STEP(x1);
+		SUMMARY_STEP(x2);
+		SUMMARY_STEP(x3);
+	}
+
+	_mm256_storeu_si256((__m256i *)v[0], sum);
+	_mm256_storeu_si256((__m256i *)v[1], min);
+	_mm256_storeu_si256((__m256i *)v[2], at);
+	_mm256_storeu_si256((__m256i *)v[3], best);
+	_mm256_storeu_si256((__m256i *)v[4], bstart);
+	_mm256_storeu_si256((__m256i *)v[5], bend);
+	_mm256_storeu_si256((__m256i *)v[6], pre);
+	_mm256_storeu_si256((__m256i *)v[7], pend);
+
+	for (l=0;l<4;l++) {
+		seg.total        = v[0][l];
+		seg.prefix.start = start + l * q;
+		seg.prefix.end   = (size_t)v[7][l];
+		seg.prefix.sum   = v[6][l];
+		seg.suffix.start = (size_t)v[2][l];
+		seg.suffix.end   = start + (l + 1) * q;
+		seg.suffix.sum   = v[0][l] - v[1][l];
+		seg.best.start   = (size_t)v[4][l];
+		seg.best.end     = (size_t)v[5][l];
+		seg.best.sum     = v[3][l];
+		s = l ? merge_summaries(s, seg) : seg;
+	}
+
+	if (start + 4 * q < end)
+		s = merge_summaries(s, summarize(array - start, start + 4 * q, end));
+	return s;
+}
 
-		if (current_max > max_subarray->sum) {
-			max_subarray->start = s;
-			max_subarray->end   = i+1;
-			max_subarray->sum   = current_max;
+__attribute__((target("avx2")))
+struct sub_array max_subarray_avx2(const long *array, size_t size)
+{
+	if (!size) return max_subarray_kadane(array, size);
+	return summarize_avx2(array, 0, size).best;
+}
+#endif /* USE_SIMD */
+
+/**
+ * The kernels, in order of preference (the last usable one is used.)
+ */
+struct subarray_kernel {
+	const char *name;
+	struct sub_array (*fn)(const long *, size_t);
+	int usable;
+};
+
+struct subarray_kernel subarray_kernels[] = {
+	{ "kadane", max_subarray_kadane, 1 },
+	#ifdef USE_SIMD
+	{ "avx2",   max_subarray_avx2,   0 },
+	#endif
+	{ NULL,     NULL,                0 }
+};
+
+/* The kernel, and the summarizer, picked by subarray_init() */
+struct sub_array (*subarray_best)(const long *, size_t) = max_subarray_kadane;
+struct segment_summary (*summarize_best)(const long *, size_t, size_t) =
+	summarize;
+
+/**
+ * Check which kernels the CPU supports, and pick the fastest one.
+ */
+void subarray_init(void)
+{
+	struct subarray_kernel *k;
+
+	#ifdef USE_SIMD
+	__builtin_cpu_init();
+	subarray_kernels[1].usable = __builtin_cpu_supports("avx2");
+	#endif
+
+	for (k=subarray_kernels;k->name;k++)
+		if (k->usable) subarray_best = k->fn;
+
+	#ifdef USE_SIMD
+	if (subarray_kernels[1].usable) summarize_best = summarize_avx2;
+	#endif
+}
+
+/**
+ * A segment tree over an array, for the maximum subarray of any range of
+ * it, as the array changes. It's kept implicitly, in one array: node i
+ * has children 2i and 2i + 1, and the leaves are nodes size to
+ * 2 size - 1, so there are no pointers to chase, and the nodes near the
+ * root, which every query visits, share cache lines. Each node holds the
+ * summary of its range.
+ */
+struct segment_tree {
+	size_t size;
+	struct segment_summary *node;
+};
+
+/**
+ * Set the leaf for element i to value.
+ */
+void tree_set_leaf(struct segment_tree *t, size_t i, long value)
+{
+	struct segment_summary *leaf = &t->node[t->size + i];
+
+	leaf->total = value;
+	leaf->best.start = i;
+	leaf->best.end   = i + 1;
+	leaf->best.sum   = value;
+	leaf->prefix = leaf->suffix = leaf->best;
+}
+
+/**
+ * Build the tree over size elements, bottom up, in O(n). Returns -1 if
+ * out of memory.
+ */
+int tree_build(struct segment_tree *t, const long *array, size_t size)
+{
+	size_t i;
+
+	t->size = size;
+	if (!(t->node = malloc((2 * size + 1) * sizeof(*t->node)))) return -1;
+
+	for (i=0;i<size;i++) tree_set_leaf(t, i, array[i]);
+	for (i=size;i-->1;)
+		t->node[i] = merge_summaries(t->node[2 * i], t->node[2 * i + 1]);
+	return 0;
+}
+
+void tree_free(struct segment_tree *t)
+{
+	free(t->node);
+	t->node = NULL;
+	t->size = 0;
+}
+
+/**
+ * Set element i to value, and fix the nodes above it, in O(log n).
+ */
+void tree_update(struct segment_tree *t, size_t i, long value)
+{
+	tree_set_leaf(t, i, value);
+	for (i=(t->size+i)/2;i>0;i/=2)
+		t->node[i] = merge_summaries(t->node[2 * i], t->node[2 * i + 1]);
+}
+
+/**
+ * Find the maximum subarray of the elements [l, r), in O(log n). This
+ * is the same subarray as Kadane's algorithm finds over the range. The
+ * range is covered by whole nodes from both ends at once; they're
+ * merged in order, from the left into left, and from the right into
+ * right, since merging isn't commutative.
+ */
+struct sub_array tree_query(const struct segment_tree *t, size_t l, size_t r)
+{
+	struct segment_summary left, right;
+	int have_left = 0, have_right = 0;
+
+	memset(&left, 0, sizeof(left));
+	memset(&right, 0, sizeof(right));
+	if (l >= r || r > t->size) return left.best;
+
+	for (l+=t->size,r+=t->size;l<r;l/=2,r/=2) {
+		if (l & 1) {
+			left = have_left ? merge_summaries(left, t->node[l]) : t->node[l];
+			have_left = 1;
+			l++;
+		}
+
+		if (r & 1) {
+			r--;
+			right = have_right ? merge_summaries(t->node[r], right) :
+			        t->node[r];
+			have_right = 1;
 		}
 	}
 
+	if (!have_left)  return right.best;
+	if (!have_right) return left.best;
+	return merge_summaries(left, right).best;
+}
+
+/**
+ * A chunk of the array for max_subarray_parallel(). Chunk n merges the
+ * summaries of chunks n + 1, n + 2, n + 4, ... (up to the lowest bit
+ * set in n) into its own, once their threads are done, so the merges
+ * form a tree, and chunk 0 ends up with the summary of the whole array.
+ */
+struct s_chunk {
+	const long *array;
+	size_t start;
+	size_t end;
+	int id;
+	int count;
+	struct s_chunk *chunks;
+	int threaded;
+	#ifdef USE_POSIX
+	pthread_t tid;
+	#endif
+	struct segment_summary s;
+};
+
+void *reduce_chunk(void *arg)
+{
+	struct s_chunk *c = arg, *child;
+	int step;
+
+	c->s = summarize_best(c->array, c->start, c->end);
+	for (step=1;!(c->id & step) && c->id + step < c->count;step<<=1) {
+		child = &c->chunks[c->id + step];
+
+		#ifdef USE_POSIX
+		if (child->threaded) pthread_join(child->tid, NULL);
+		else reduce_chunk(child);
+		#else
+		reduce_chunk(child);
+		#endif
+
+		c->s = merge_summaries(c->s, child->s);
+	}
+
+	return NULL;
+}
+
+/**
+ * Find the maximum subarray with the given number of threads, each
+ * summarizing a chunk of the array, and merging them pairwise. This
+ * returns the same subarray as max_subarray_kadane(). A chunk whose
+ * thread couldn't be started is done by the one which merges it.
+ */
+struct sub_array max_subarray_parallel(const long *array, size_t size,
+                                       int threads)
+{
+	struct s_chunk chunks[MAX_THREADS];
+	size_t chunk;
+	int t;
+
+	if (threads > MAX_THREADS)     threads = MAX_THREADS;
+	if ((size_t)threads > size)    threads = (int)size;
+	if (threads < 2) return subarray_best(array, size);
+
+	chunk = size / (size_t)threads;
+	for (t=0;t<threads;t++) {
+		chunks[t].array    = array;
+		chunks[t].start    = (size_t)t * chunk;
+		chunks[t].end      = t < threads - 1 ? chunks[t].start + chunk : size;
+		chunks[t].id       = t;
+		chunks[t].count    = threads;
+		chunks[t].chunks   = chunks;
+		chunks[t].threaded = 0;
+	}
+
+	/* Children first, so that they're set up before their parent runs */
+	#ifdef USE_POSIX
+	for (t=threads-1;t>0;t--)
+		chunks[t].threaded = !pthread_create(&chunks[t].tid, NULL,
+		                                     reduce_chunk, &chunks[t]);
+	#endif
+
+	reduce_chunk(&chunks[0]);
+	return chunks[0].s.best;
+}
+
+/**
+ * An entry in max_subarray_bounded()'s deque: a start, and the sum of the
+ * elements before it.
+ */
+struct deque_entry {
+	size_t start;
+	long prefix;
+};
+
+/**
+ * Find the maximum subarray whose length is in [min_len, max_len]. The
+ * sum of [s, e) is P(e) - P(s), for the prefix sums P, so for each end e
+ * this wants the smallest P(s) for s in [e - max_len, e - min_len]. That
+ * window slides along by one each time, so its minimum is kept in a
+ * monotonic deque: the starts whose P(s) is smaller than that of every
+ * start after them, in order, so the smallest is at the front.
+ *
+ * Ties are broken as Kadane's algorithm does, and with min_len 1 and
+ * max_len size, this finds the same subarray. If no length fits (or
+ * it's out of memory), the subarray is empty.
+ *
+ * This runs in O(n) time, and O(max_len - min_len) space.
+ */
+struct sub_array max_subarray_bounded(const long *array, size_t size,
+                                      size_t min_len, size_t max_len)
+{
+	struct sub_array max_subarray = { 0, 0, 0 };
+	struct deque_entry *dq;
+	size_t mask = 1, head = 0, len = 0, e, s;
+	long sum = 0, lag = 0, c;
+
+	if (!min_len) min_len = 1;
+	if (max_len > size) max_len = size;
+	if (min_len > max_len) return max_subarray;
+
+	/* A ring buffer, a power of two in size, for at most this many starts */
+	while (mask < max_len - min_len + 1) mask <<= 1;
+	if (!(dq = malloc(mask * sizeof(*dq)))) return max_subarray;
+	mask--;
+
+	for (e=0;e<min_len-1;e++) sum += array[e];
+	for (e=min_len;e<=size;e++) {
+		sum += array[e - 1];
+
+		/* Drop the start which is now too far back */
+		if (len && dq[head].start + max_len < e) {
+			head = (head + 1) & mask;
+			len--;
+		}
+
+		/* Add the newest start, s, whose prefix sum is lag */
+		s = e - min_len;
+		while (len && dq[(head + len - 1) & mask].prefix > lag) len--;
+		dq[(head + len) & mask].start  = s;
+		dq[(head + len) & mask].prefix = lag;
+		len++;
+		lag += array[s];
+
+		c = sum - dq[head].prefix;
+		if (!max_subarray.end || c > max_subarray.sum) {
+			max_subarray.start = dq[head].start;
+			max_subarray.end   = e;
+			max_subarray.sum   = c;
+		}
+	}
+
+	free(dq);
 	return max_subarray;
 }
 
+/**
+ * The maximum submatrix: rows [top, bottom), and columns [left, right).
+ */
+struct sub_matrix {
+	size_t top;
+	size_t bottom;
+	size_t left;
+	size_t right;
+	long sum;
+};
+
+/**
+ * Is a better than b? The larger sum, or on a tie, the smaller top, then
+ * the smaller bottom. Each pair of rows has one candidate, so this
+ * doesn't depend on the order they're found in.
+ */
+int submatrix_better(const struct sub_matrix *a, const struct sub_matrix *b)
+{
+	if (a->sum != b->sum) return a->sum > b->sum;
+	if (a->top != b->top) return a->top < b->top;
+	return a->bottom < b->bottom;
+}
+
+/**
+ * A band of tops for max_submatrix(): each thread takes every threads'th
+ * block of BLOCK_ROWS tops, so that they share the work evenly, since
+ * the higher tops have more bottoms.
+ */
+struct s_band {
+	const long *matrix;
+	size_t rows;
+	size_t cols;
+	int id;
+	int threads;
+	long *sums;
+	int found;
+	struct sub_matrix best;
+	int threaded;
+	#ifdef USE_POSIX
+	pthread_t tid;
+	#endif
+};
+
+void *submatrix_band(void *arg)
+{
+	struct s_band *band = arg;
+	struct segment_summary s[BLOCK_ROWS], seg;
+	struct sub_matrix m;
+	size_t cols = band->cols, top, b, c, w, j, t, n, nt;
+	const long *row;
+	long *sums;
+
+	for (top=(size_t)band->id*BLOCK_ROWS;top<band->rows;
+	     top+=(size_t)band->threads*BLOCK_ROWS) {
+		n = band->rows - top < BLOCK_ROWS ? band->rows - top : BLOCK_ROWS;
+		memset(band->sums, 0, n * cols * sizeof(long));
+
+		/**
+		 * Add each row to the column sums of the tops above it, and run
+		 * Kadane's (as summaries) over the sums, a block at a time.
+		 */
+		for (b=top;b<band->rows;b++) {
+			row = band->matrix + b * cols;
+			nt  = b - top + 1 < n ? b - top + 1 : n;
+
+			for (c=0;c<cols;c+=BLOCK_COLS) {
+				w = cols - c < BLOCK_COLS ? cols - c : BLOCK_COLS;
+				for (t=0;t<nt;t++) {
+					sums = band->sums + t * cols;
+					for (j=c;j<c+w;j++) sums[j] += row[j];
+
+					seg  = summarize_best(sums, c, c + w);
+					s[t] = c ? merge_summaries(s[t], seg) : seg;
+				}
+			}
+
+			for (t=0;t<nt;t++) {
+				m.top    = top + t;
+				m.bottom = b + 1;
+				m.left   = s[t].best.start;
+				m.right  = s[t].best.end;
+				m.sum    = s[t].best.sum;
+				if (!band->found || submatrix_better(&m, &band->best)) {
+					band->best  = m;
+					band->found = 1;
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Find the maximum submatrix of a rows x cols matrix, stored by rows.
+ * For each pair of rows, the sums of each column between them make an
+ * array, and the best subarray of that is the best submatrix between
+ * those rows. Pairs of rows are shared between the threads.
+ *
+ * This runs in O(rows^2 cols) time, so pass the matrix with fewer rows
+ * than columns, and O(cols) space per thread. Returns -1 if out of
+ * memory.
+ */
+int max_submatrix(const long *matrix, size_t rows, size_t cols,
+                  int threads, struct sub_matrix *best)
+{
+	struct s_band bands[MAX_THREADS];
+	int t;
+
+	memset(best, 0, sizeof(*best));
+	if (!rows || !cols) return 0;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+	if ((size_t)threads > (rows + BLOCK_ROWS - 1) / BLOCK_ROWS)
+		threads = (int)((rows + BLOCK_ROWS - 1) / BLOCK_ROWS);
+	if (threads < 1) threads = 1;
+
+	for (t=0;t<threads;t++) {
+		bands[t].matrix   = matrix;
+		bands[t].rows     = rows;
+		bands[t].cols     = cols;
+		bands[t].id       = t;
+		bands[t].threads  = threads;
+		bands[t].found    = 0;
+		bands[t].threaded = 0;
+		if (!(bands[t].sums = malloc(BLOCK_ROWS * cols * sizeof(long)))) {
+			while (t--) free(bands[t].sums);
+			return -1;
+		}
+	}
+
+	#ifdef USE_POSIX
+	for (t=1;t<threads;t++)
+		bands[t].threaded = !pthread_create(&bands[t].tid, NULL,
+		                                    submatrix_band, &bands[t]);
+	#endif
+
+	submatrix_band(&bands[0]);
+	for (t=0;t<threads;t++) {
+		#ifdef USE_POSIX
+		if (t && bands[t].threaded) pthread_join(bands[t].tid, NULL);
+		else if (t) submatrix_band(&bands[t]);
+		#else
+		if (t) submatrix_band(&bands[t]);
+		#endif
+
+		if (bands[t].found && (!t || submatrix_better(&bands[t].best, best)))
+			*best = bands[t].best;
+		free(bands[t].sums);
+	}
+
+	return 0;
+}
+
+double bench_now(void)
+{
+	#ifdef USE_POSIX
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+	#else
+	return (double)clock() / CLOCKS_PER_SEC;
+	#endif
+}
+
+/**
+ * Allocate n random numbers in [-1000, 1000] for the benchmarks.
+ */
+long *random_array(size_t n)
+{
+	unsigned long x = 1;
+	size_t i;
+	long *a;
+
+	if (!(a = malloc(n * sizeof(long)))) {
+		fprintf(stderr, "Unable to allocate the benchmark array!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i=0;i<n;i++) {
+		x    = (x * 1103515245UL + 12345UL) & 0xffffffffUL;
+		a[i] = (long)((x >> 8) % 2001) - 1000;
+	}
+
+	return a;
+}
+
+/**
+ * Run each kernel over count random numbers, and check that they all
+ * agree.
+ */
+void benchmark(long count)
+{
+	struct subarray_kernel *k;
+	struct sub_array ref = { 0, 0, 0 }, res;
+	size_t n = (size_t)count;
+	long *a = random_array(n);
+	double t;
+
+	printf("%-8s %9s %8s %10s %12s %12s %12s\n", "Kernel", "Time (s)",
+	       "GB/s", "ns/number", "Sum", "Start", "End");
+	for (k=subarray_kernels;k->name;k++) {
+		if (!k->usable) continue;
+
+		t   = bench_now();
+		res = k->fn(a, n);
+		t   = bench_now() - t;
+		if (k == subarray_kernels) ref = res;
+
+		printf("%-8s %9.6f %8.3f %10.3f %12ld %12lu %12lu%s\n", k->name, t,
+		       t > 0 ? (double)n * sizeof(long) / t / 1e9 : 0.0,
+		       t * 1e9 / (double)n, res.sum, (unsigned long)res.start,
+		       (unsigned long)res.end,
+		       res.sum != ref.sum || res.start != ref.start ||
+		       res.end != ref.end ? " (MISMATCH)" : "");
+	}
+
+	free(a);
+}
+
+/**
+ * Run max_subarray_parallel() over count random numbers with 1, 2, 4,
+ * ... threads, up to the given number, and compare it with Kadane's
+ * algorithm on one thread.
+ */
+void benchmark_parallel(long count, int threads)
+{
+	struct sub_array ref, res;
+	size_t n = (size_t)count;
+	long *a = random_array(n);
+	double t, t1;
+	int th;
+
+	printf("%-7s %9s %8s %8s %12s %12s %12s\n", "Threads", "Time (s)",
+	       "GB/s", "Speedup", "Sum", "Start", "End");
+
+	t1  = bench_now();
+	ref = max_subarray_kadane(a, n);
+	t1  = bench_now() - t1;
+	printf("%-7s %9.6f %8.3f %8.2f %12ld %12lu %12lu\n", "kadane", t1,
+	       t1 > 0 ? (double)n * sizeof(long) / t1 / 1e9 : 0.0, 1.0,
+	       ref.sum, (unsigned long)ref.start, (unsigned long)ref.end);
+
+	for (th=1;th<=threads;th=(th*2>threads && th<threads) ? threads : th*2) {
+		t   = bench_now();
+		res = max_subarray_parallel(a, n, th);
+		t   = bench_now() - t;
+
+		printf("%-7d %9.6f %8.3f %8.2f %12ld %12lu %12lu%s\n", th, t,
+		       t > 0 ? (double)n * sizeof(long) / t / 1e9 : 0.0,
+		       t > 0 ? t1 / t : 0.0, res.sum, (unsigned long)res.start,
+		       (unsigned long)res.end,
+		       res.sum != ref.sum || res.start != ref.start ||
+		       res.end != ref.end ? " (MISMATCH)" : "");
+	}
+
+	free(a);
+}
+
+/**
+ * Find the maximum submatrix of a size x size matrix of random numbers,
+ * with 1, 2, 4, ... threads, up to the given number. Each pair of rows
+ * is size column sums for Kadane's algorithm, so the rate is of those.
+ */
+void benchmark_matrix(long size, int threads)
+{
+	struct sub_matrix ref, res;
+	size_t n = (size_t)size;
+	long *m = random_array(n * n);
+	double t, t1 = 0, cells = (double)n * (n + 1) / 2 * n;
+	int th;
+
+	memset(&ref, 0, sizeof(ref));
+	printf("%-7s %10s %10s %8s %12s %14s %14s\n", "Threads", "Time (s)",
+	       "Gcells/s", "Speedup", "Sum", "Rows", "Columns");
+	for (th=1;th<=threads;th=(th*2>threads && th<threads) ? threads : th*2) {
+		t = bench_now();
+		if (max_submatrix(m, n, n, th, &res)) {
+			fprintf(stderr, "Unable to allocate the column sums!\n");
+			exit(EXIT_FAILURE);
+		}
+		t = bench_now() - t;
+
+		if (th == 1) {
+			ref = res;
+			t1  = t;
+		}
+
+		printf("%-7d %10.3f %10.3f %8.2f %12ld %6lu-%-7lu %6lu-%lu%s\n", th,
+		       t, t > 0 ? cells / t / 1e9 : 0.0, t > 0 ? t1 / t : 0.0,
+		       res.sum, (unsigned long)res.top, (unsigned long)res.bottom,
+		       (unsigned long)res.left, (unsigned long)res.right,
+		       memcmp(&res, &ref, sizeof(res)) ? " (MISMATCH)" : "");
+	}
+
+	free(m);
+}
+
+/**
+ * Time max_subarray_bounded() over count random numbers, with no bounds
+ * (against Kadane's algorithm, which it should agree with), and with
+ * lengths in [min_len, max_len].
+ */
+void benchmark_bounded(long count, size_t min_len, size_t max_len)
+{
+	struct sub_array res[3];
+	const char *names[3];
+	size_t n = (size_t)count;
+	long *a = random_array(n);
+	double t[3];
+	int i;
+
+	names[0] = "kadane";
+	names[1] = "bounded (1, n)";
+	names[2] = "bounded";
+
+	t[0]   = bench_now();
+	res[0] = max_subarray_kadane(a, n);
+	t[0]   = bench_now() - t[0];
+	t[1]   = bench_now();
+	res[1] = max_subarray_bounded(a, n, 1, n);
+	t[1]   = bench_now() - t[1];
+	t[2]   = bench_now();
+	res[2] = max_subarray_bounded(a, n, min_len, max_len);
+	t[2]   = bench_now() - t[2];
+
+	printf("%-15s %9s %10s %12s %12s %12s\n", "Kernel", "Time (s)",
+	       "ns/number", "Sum", "Start", "End");
+	for (i=0;i<3;i++) {
+		printf("%-15s %9.6f %10.3f %12ld %12lu %12lu%s\n", names[i], t[i],
+		       t[i] * 1e9 / (double)n, res[i].sum,
+		       (unsigned long)res[i].start, (unsigned long)res[i].end,
+		       i == 1 && (res[1].sum != res[0].sum ||
+		       res[1].start != res[0].start || res[1].end != res[0].end) ?
+		       " (MISMATCH)" : "");
+	}
+
+	free(a);
+}
+
+/**
+ * Pick a random range [l, r) of n elements for benchmark_tree().
+ */
+void random_range(unsigned long *x, size_t n, size_t *l, size_t *r)
+{
+	size_t a, b;
+
+	*x = (*x * 1103515245UL + 12345UL) & 0xffffffffUL;
+	a  = (size_t)(*x % n);
+	*x = (*x * 1103515245UL + 12345UL) & 0xffffffffUL;
+	b  = (size_t)(*x % n);
+
+	*l = a < b ? a : b;
+	*r = (a < b ? b : a) + 1;
+}
+
+/**
+ * Time building a segment tree over count random numbers, then random
+ * range queries of it, and point updates, against Kadane's algorithm
+ * over each range. (Kadane's is only run for as many queries as take
+ * about as long as the tree's, since each is O(n).)
+ */
+void benchmark_tree(long count, long queries)
+{
+	struct segment_tree tree;
+	struct sub_array a, b;
+	unsigned long x = 7;
+	size_t n = (size_t)count, l, r;
+	long *array = random_array(n), i, kq, bad = 0;
+	double t[4];
+
+	t[0] = bench_now();
+	if (tree_build(&tree, array, n)) {
+		fprintf(stderr, "Unable to allocate the segment tree!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	t[1] = bench_now();
+	for (i=0;i<queries;i++) {
+		random_range(&x, n, &l, &r);
+		a = tree_query(&tree, l, r);
+		bad += a.start < l || a.end > r;
+	}
+
+	t[2] = bench_now();
+	for (i=0;i<queries;i++) {
+		random_range(&x, n, &l, &r);
+		tree_update(&tree, l, (long)(x % 2001) - 1000);
+		array[l] = (long)(x % 2001) - 1000;
+	}
+	t[3] = bench_now();
+
+	printf("%-14s %10s %10s %14s\n", "Operation", "Count", "Time (s)",
+	       "Ops/s");
+	printf("%-14s %10lu %10.6f %14.0f\n", "build", (unsigned long)n,
+	       t[1] - t[0], t[1] > t[0] ? n / (t[1] - t[0]) : 0.0);
+	printf("%-14s %10ld %10.6f %14.0f\n", "query (tree)", queries,
+	       t[2] - t[1], t[2] > t[1] ? queries / (t[2] - t[1]) : 0.0);
+	printf("%-14s %10ld %10.6f %14.0f\n", "update", queries, t[3] - t[2],
+	       t[3] > t[2] ? queries / (t[3] - t[2]) : 0.0);
+
+	/* Queries after the updates, checked against Kadane's */
+	t[0] = bench_now();
+	for (kq=0;kq<queries && bench_now() - t[0] < t[2] - t[1];kq++) {
+		random_range(&x, n, &l, &r);
+		a = max_subarray_kadane(array + l, r - l);
+		b = tree_query(&tree, l, r);
+		bad += a.start + l != b.start || a.end + l != b.end || a.sum != b.sum;
+	}
+	t[1] = bench_now();
+
+	printf("%-14s %10ld %10.6f %14.0f%s\n", "query (kadane)", kq,
+	       t[1] - t[0], t[1] > t[0] ? kq / (t[1] - t[0]) : 0.0,
+	       bad ? " (MISMATCH)" : "");
+
+	tree_free(&tree);
+	free(array);
+}
+
+/**
+ * A parser of numbers in text, which can stop and resume anywhere, even
+ * in the middle of a number. The numbers are separated by whitespace or
+ * commas, and are passed to Kadane's algorithm a batch at a time.
+ */
+struct text_parser {
+	unsigned long value;
+	int sign;
+	int digits;
+	unsigned long line;
+	size_t n;
+	long batch[TEXT_BATCH];
+};
+
+void text_init(struct text_parser *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->line = 1;
+}
+
+/**
+ * End the number being parsed, if any. Returns -1 for a sign on its own.
+ */
+int text_end_number(struct text_parser *p, struct kadane_state *k)
+{
+	if (!p->digits) return p->sign ? -1 : 0;
+
+	p->batch[p->n++] = p->sign < 0 ? (long)(0UL - p->value) : (long)p->value;
+	if (p->n == TEXT_BATCH) {
+		kadane_feed(k, p->batch, p->n);
+		p->n = 0;
+	}
+
+	p->value  = 0;
+	p->sign   = 0;
+	p->digits = 0;
+	return 0;
+}
+
+/**
+ * Parse the next len bytes of text. Returns -1 (and p->line is the line
+ * it's on) for anything that isn't a number which fits in a long.
+ */
+int text_feed(struct text_parser *p, struct kadane_state *k,
+              const char *buf, size_t len)
+{
+	const char *end = buf + len;
+	unsigned long d, value = p->value;
+	int digits = p->digits;
+
+	while (buf < end) {
+		/* Most bytes are digits, so take them in a tight loop */
+		while (buf < end &&
+		       (d = (unsigned long)(unsigned char)*buf - '0') < 10) {
+			/* A negative number may be one more than LONG_MAX */
+			if (value > ((unsigned long)LONG_MAX - d) / 10 &&
+			    value > ((unsigned long)LONG_MAX + (p->sign < 0) - d) / 10)
+				return -1;
+			value = value * 10 + d;
+			digits++;
+			buf++;
+		}
+		if (buf == end) break;
+
+		if ((*buf == '-' || *buf == '+') && !p->sign && !digits) {
+			p->sign = *buf == '-' ? -1 : 1;
+		} else if (*buf == '\n' || *buf == ' ' || *buf == ',' ||
+		           *buf == '\t' || *buf == '\r') {
+			p->value  = value;
+			p->digits = digits;
+			if (text_end_number(p, k)) return -1;
+			if (*buf == '\n') p->line++;
+			value  = 0;
+			digits = 0;
+		} else return -1;
+		buf++;
+	}
+
+	p->value  = value;
+	p->digits = digits;
+	return 0;
+}
+
+/**
+ * Finish parsing: end the last number, and pass on the last batch.
+ */
+int text_finish(struct text_parser *p, struct kadane_state *k)
+{
+	if (text_end_number(p, k)) return -1;
+	kadane_feed(k, p->batch, p->n);
+	p->n = 0;
+	return 0;
+}
+
+/**
+ * Find the maximum subarray of a file (or stdin, if path is NULL) of
+ * native 64-bit numbers, or of text, in one pass, with Kadane's
+ * algorithm. Regular files are mapped into memory with USE_POSIX;
+ * anything else is read a chunk at a time, so it works on pipes.
+ */
+int stream_file(const char *path, int text)
+{
+	union {
+		long l[STREAM_CHUNK / sizeof(long)];
+		char c[STREAM_CHUNK];
+	} buf;
+	struct kadane_state k;
+	struct text_parser p;
+	size_t n, have = 0, bytes = 0;
+	int mapped = 0, bad = 0;
+	FILE *fp = stdin;
+	double t;
+	#ifdef USE_POSIX
+	struct stat st;
+	char *map;
+	int fd;
+	#endif
+
+	if (!text && sizeof(long) != 8) {
+		fprintf(stderr, "Binary input needs 64-bit longs!\n");
+		return EXIT_FAILURE;
+	}
+
+	kadane_init(&k);
+	text_init(&p);
+	t = bench_now();
+
+	#ifdef USE_POSIX
+	if (path) {
+		if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st)) {
+			perror(path);
+			return EXIT_FAILURE;
+		}
+
+		if (S_ISREG(st.st_mode) && st.st_size > 0) {
+			bytes = (size_t)st.st_size;
+			map   = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED) {
+				perror("mmap");
+				close(fd);
+				return EXIT_FAILURE;
+			}
+
+			posix_madvise(map, bytes, POSIX_MADV_SEQUENTIAL);
+			if (text) bad = text_feed(&p, &k, map, bytes);
+			else kadane_feed(&k, (const long *)map, bytes / sizeof(long));
+			have   = text ? 0 : bytes % sizeof(long);
+			mapped = 1;
+			munmap(map, bytes);
+		}
+		close(fd);
+	}
+	#endif
+
+	if (!mapped && path && !(fp = fopen(path, "rb"))) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	/* Binary numbers may be split between reads; keep the partial one */
+	while (!mapped && !bad &&
+	       (n = fread(buf.c + have, 1, sizeof(buf) - have, fp)) > 0) {
+		bytes += n;
+		have  += n;
+		if (text) {
+			bad  = text_feed(&p, &k, buf.c, have);
+			have = 0;
+		} else {
+			kadane_feed(&k, buf.l, have / sizeof(long));
+			memmove(buf.c, buf.c + have - have % sizeof(long),
+			        have % sizeof(long));
+			have %= sizeof(long);
+		}
+	}
+
+	if (!mapped && fp != stdin) fclose(fp);
+	if (text && !bad) bad = text_finish(&p, &k);
+	t = bench_now() - t;
+
+	if (bad) {
+		fprintf(stderr, "%s: Bad number on line %lu\n", path ? path : "stdin",
+		        p.line);
+		return EXIT_FAILURE;
+	}
+
+	if (have) {
+		fprintf(stderr, "Ignoring %lu bytes at the end\n",
+		        (unsigned long)have);
+	}
+
+	if (!k.count) {
+		fprintf(stderr, "%s: No numbers\n", path ? path : "stdin");
+		return EXIT_FAILURE;
+	}
+
+	printf("The maximum sub-array is: [ %lu, %lu ) with sum: %ld\n",
+	       (unsigned long)k.best.start, (unsigned long)k.best.end,
+	       k.best.sum);
+	printf("%lu numbers, %lu bytes in %.6f s (%.3f GB/s)\n",
+	       (unsigned long)k.count, (unsigned long)bytes, t,
+	       t > 0 ? (double)bytes / t / 1e9 : 0.0);
+	return EXIT_SUCCESS;
+}
+
+/* Pairs of decimal digits, "00" through "99" */
+const char digit_pairs[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/**
+ * Write the decimal digits of v into buf, two at a time, and return
+ * how many were written. No NUL is appended. main() formats the
+ * elements of the result with this, adding the sign itself, and writes
+ * them out a buffer at a time.
+ */
+size_t format_ulong(char *buf, unsigned long v)
+{
+	char tmp[24], *p = tmp + sizeof(tmp);
+	unsigned long i;
+
+	while (v >= 100) {
+		i  = (v % 100) * 2;
+		v /= 100;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	}
+
+	if (v >= 10) {
+		*--p = digit_pairs[v * 2 + 1];
+		*--p = digit_pairs[v * 2];
+	} else *--p = (char)('0' + v);
+
+	memcpy(buf, p, (size_t)(tmp + sizeof(tmp) - p));
+	return (size_t)(tmp + sizeof(tmp) - p);
+}
+
+/**
+ * The number of threads to use: arg, or by default, one for each CPU.
+ */
+int thread_count(const char *arg)
+{
+	int threads;
+
+	#ifdef USE_POSIX
+	threads = arg ? atoi(arg) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	#else
+	threads = arg ? atoi(arg) : 1;
+	#endif
+	return threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
+}
+
 void usage(char *arg0)
 {
 	printf("Usage: %s variant n1 n2 ...\n",arg0);
+	printf("       %s -b [count]\n",arg0);
+	printf("       %s -bt [count [threads]]\n",arg0);
+	printf("       %s -s|-st [file]\n",arg0);
+	printf("       %s -bq [count [queries]]\n",arg0);
+	printf("       %s -w min max n1 n2 ...\n",arg0);
+	printf("       %s -m rows cols n1 n2 ...\n",arg0);
+	printf("       %s -b2 [size [threads]]\n",arg0);
+	printf("       %s -bw [count [min max]]\n",arg0);
 	printf("\tvariant: 0 for our O(n^2) algorithm\n");
 	printf("\t         1 for Kadane's O(n) algorithm\n");
 	printf("\tn: Array of integers separated by spaces\n");
+	printf("\t-b: Benchmark the O(n) kernels over count numbers\n");
+	printf("\t-bt: Benchmark the threaded search over count numbers\n");
+	printf("\t-s: Stream 64-bit numbers from file, or stdin\n");
+	printf("\t-st: Stream numbers as text from file, or stdin\n");
+	printf("\t-bq: Benchmark range queries of a segment tree\n");
+	printf("\t-w: The maximum sub-array of length min to max\n");
+	printf("\t-m: The maximum sub-matrix of a rows x cols matrix\n");
+	printf("\t-b2: Benchmark the maximum sub-matrix of a size x size matrix\n");
+	printf("\t-bw: Benchmark the length-bounded search over count numbers\n");
 	exit(EXIT_FAILURE);
 }
 
+/**
+ * Find the maximum submatrix of the matrix on the command line: rows,
+ * columns, then the elements, row by row.
+ */
+int matrix_args(int argc, char *argv[])
+{
+	struct sub_matrix best;
+	size_t rows, cols, i;
+	long *m;
+
+	if (argc < 5) usage(argv[0]);
+	rows = (size_t)atol(argv[2]);
+	cols = (size_t)atol(argv[3]);
+	if (!rows || !cols || rows * cols != (size_t)argc - 4) {
+		fprintf(stderr, "Expected %lu x %lu numbers!\n", (unsigned long)rows,
+		        (unsigned long)cols);
+		return EXIT_FAILURE;
+	}
+
+	if (!(m = malloc(rows * cols * sizeof(long)))) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i=0;i<rows*cols;i++) m[i] = atol(argv[i + 4]);
+	if (max_submatrix(m, rows, cols, 1, &best)) {
+		fprintf(stderr, "Out of memory!\n");
+		free(m);
+		return EXIT_FAILURE;
+	}
+
+	printf("The maximum sub-matrix is: rows [ %lu, %lu ), columns [ %lu, %lu )"
+	       " with sum: %ld\n", (unsigned long)best.top,
+	       (unsigned long)best.bottom, (unsigned long)best.left,
+	       (unsigned long)best.right, best.sum);
+	free(m);
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
-	unsigned int i = 2; long *array = NULL;
-	struct sub_array *max_subarray = NULL;
-	if (argc < 3) usage(argv[0]);
+	size_t i, first = 2, min_len = 0, max_len = 0; long *array = NULL;
+	struct sub_array max_subarray;
+	char buf[BUFSIZ]; size_t len = 0;
+
+	subarray_init();
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		benchmark(argc > 2 ? atol(argv[2]) : BENCH_COUNT);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-bt")) {
+		benchmark_parallel(argc > 2 ? atol(argv[2]) : BENCH_COUNT,
+		                   thread_count(argc > 3 ? argv[3] : NULL));
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-b2")) {
+		benchmark_matrix(argc > 2 && atol(argv[2]) > 0 ? atol(argv[2]) :
+		                 MATRIX_SIZE, thread_count(argc > 3 ? argv[3] : NULL));
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-bw")) {
+		benchmark_bounded(argc > 2 && atol(argv[2]) > 0 ? atol(argv[2]) :
+		                  BENCH_COUNT / 10,
+		                  argc > 3 ? (size_t)atol(argv[3]) : 16,
+		                  argc > 4 ? (size_t)atol(argv[4]) : 1024);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-m")) return matrix_args(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "-w")) {
+		if (argc < 5) usage(argv[0]);
+		min_len = (size_t)atol(argv[2]);
+		max_len = (size_t)atol(argv[3]);
+		first   = 4;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-bq")) {
+		benchmark_tree(argc > 2 && atol(argv[2]) > 0 ? atol(argv[2]) :
+		               TREE_COUNT, argc > 3 ? atol(argv[3]) : TREE_QUERIES);
+		return 0;
+	}
+
+	if (argc > 1 && (!strcmp(argv[1], "-s") || !strcmp(argv[1], "-st"))) {
+		return stream_file(argc > 2 && strcmp(argv[2], "-") ? argv[2] : NULL,
+		                   argv[1][2] == 't');
+	}
+
+	if ((size_t)argc <= first) usage(argv[0]);
 
 	/* Allocate our array */
-	if (!(array = calloc((unsigned int)(argc - 1), sizeof(long)))) {
+	if (!(array = calloc((unsigned int)argc - first, sizeof(long)))) {
 		fprintf(stderr, "Out of memory!\n");
 		exit(EXIT_FAILURE);
 	}
 
 	/* Read the array from the command line arguments */
-	while (i < (unsigned int)argc) {
-		array[i-1] = atol((const char *)argv[i]);
-		i++;
-	}
+	for (i=first;i<(size_t)argc;i++)
+		array[i-first] = atol((const char *)argv[i]);
 
 	/* Do it */
-	if (atoi(argv[1])) max_subarray = max_subarray_kadane(array, i-1);
-	else               max_subarray = find_max_subarray(array, i-1);
+	if (first == 4)
+		max_subarray = max_subarray_bounded(array, i-first, min_len, max_len);
+	else if (atoi(argv[1])) max_subarray = subarray_best(array, i-first);
+	else                    max_subarray = find_max_subarray(array, i-first);
 
-	/* Print the result */
+	if (!max_subarray.end) {
+		printf("No sub-array has a length in [ %lu, %lu ]\n",
+		       (unsigned long)min_len, (unsigned long)max_len);
+		free(array);
+		return EXIT_FAILURE;
+	}
+
+	/* Print the result, flushing the buffer as it fills */
 	printf("The maximum sub-array is: [ ");
-	for (i=max_subarray->start;i<max_subarray->end;i++) {
-		printf("%ld",array[i]);
-		if (i < max_subarray->end - 1) printf(", ");
+	for (i=max_subarray.start;i<max_subarray.end;i++) {
+		if (len > sizeof(buf) - 32) {
+			fwrite(buf, 1, len, stdout);
+			len = 0;
+		}
+
+		/* Negate as unsigned, so that LONG_MIN doesn't overflow */
+		if (array[i] < 0) {
+			buf[len++] = '-';
+			len += format_ulong(buf + len, 0UL - (unsigned long)array[i]);
+		} else len += format_ulong(buf + len, (unsigned long)array[i]);
+
+		if (i < max_subarray.end - 1) {
+			buf[len++] = ',';
+			buf[len++] = ' ';
+		}
 	}
-	printf(" ] with sum: %ld\n", max_subarray->sum);
+	fwrite(buf, 1, len, stdout);
+	printf(" ] with sum: %ld\n", max_subarray.sum);
 
-	free(max_subarray);
 	free(array);
 	return 0;
 }